@@ -0,0 +1,86 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../utils/frame_parser.h"
+
+// Microbenchmark for FrameParser: feeds a stream of pipelined request frames
+// in fixed-size chunks, the way recv() hands them over, and reports frames/sec.
+//
+// Usage: ./frame-parser-bench [frame-count] [rounds]
+
+static std::string build_frame(const std::string &command, const std::string &body)
+{
+    return command + "\nContent-Length: " + std::to_string(body.size()) + "\n" + body;
+}
+
+// A mix of the frames a scripted client sends: LOGIN, LIST, READ and SEND with a 1 KiB body
+static std::string build_stream(size_t frame_count)
+{
+    std::string mail_body = "receiver\nsubject line\n" + std::string(1024, 'x') + "\n.\n";
+    std::vector<std::string> frames = {
+        build_frame("LOGIN", "if23b001\nsecret-password\n"),
+        build_frame("LIST", ""),
+        build_frame("READ", "42\n"),
+        build_frame("SEND", mail_body),
+    };
+
+    std::string stream;
+    for (size_t i = 0; i < frame_count; i++)
+    {
+        stream += frames[i % frames.size()];
+    }
+    return stream;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t frame_count = argc > 1 ? std::stoul(argv[1]) : 200000;
+    int rounds = argc > 2 ? std::stoi(argv[2]) : 5;
+
+    std::string stream = build_stream(frame_count);
+    const size_t chunk_sizes[] = {64, 1460, 16384, 65536};
+
+    std::cout << "frames per round: " << frame_count << ", stream size: " << stream.size() / 1024 << " KiB\n";
+
+    for (size_t chunk_size : chunk_sizes)
+    {
+        size_t parsed = 0;
+        size_t body_bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        for (int round = 0; round < rounds; round++)
+        {
+            FrameParser parser;
+            Frame frame;
+            for (size_t offset = 0; offset < stream.size(); offset += chunk_size)
+            {
+                size_t length = std::min(chunk_size, stream.size() - offset);
+                std::memcpy(parser.write_ptr(length), stream.data() + offset, length);
+                parser.commit(length);
+
+                while (parser.next(frame) == FrameParser::Status::Complete)
+                {
+                    parsed++;
+                    body_bytes += frame.body.size();
+                }
+            }
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (parsed != frame_count * rounds)
+        {
+            std::cout << "chunk " << chunk_size << ": parsed " << parsed << " frames, expected " << frame_count * rounds << "\n";
+            return EXIT_FAILURE;
+        }
+
+        double seconds = elapsed.count();
+        std::cout << "chunk " << chunk_size << " B: "
+                  << static_cast<long>(parsed / seconds) << " frames/s, "
+                  << static_cast<long>(stream.size() * rounds / seconds / (1024 * 1024)) << " MiB/s"
+                  << " (body bytes " << body_bytes << ")\n";
+    }
+
+    return EXIT_SUCCESS;
+}
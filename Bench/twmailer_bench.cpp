@@ -0,0 +1,447 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../Client/CommandBuilder/command_builder.h"
+#include "../utils/frame_parser.h"
+
+// Load generator for a running server: opens N connections, each on its own
+// thread, and sends a weighted mix of LOGIN/SEND/LIST/READ/DEL back to back
+// (one request in flight per connection). Reports throughput and the latency
+// percentiles per command.
+//
+// Every connection logs in as <user><n> and mails itself, READ and DEL pick
+// ids from the last LIST. A LOGIN in the mix opens a new connection first: the
+// server counts every login of a connection towards the blacklist limit. For
+// many connections or a high LOGIN share start the server with a larger
+// --max-per-ip / --ip-rate and an authenticator that accepts the users
+// (e.g. --auth mock).
+//
+// Usage: ./twmailer-bench <ip> <port> [--connections n] [--duration s]
+//            [--mix login=1,send=4,list=3,read=3,del=1] [--size bytes]
+//            [--user prefix] [--users n] [--password pw]
+
+enum Command
+{
+    LOGIN,
+    SEND,
+    LIST,
+    READ,
+    DEL,
+    COMMAND_COUNT
+};
+
+static const char *COMMAND_NAMES[COMMAND_COUNT] = {"LOGIN", "SEND", "LIST", "READ", "DEL"};
+
+struct BenchOptions
+{
+    std::string ip;
+    int port = 0;
+    int connections = 16;
+    int duration = 10; // in seconds
+    size_t message_size = 1024;
+    std::string user = "bench";
+    int users = 0; // distinct users, 0 = one per connection
+    std::string password = "bench";
+    int weights[COMMAND_COUNT] = {1, 4, 3, 3, 1};
+};
+
+// Results of one connection, merged after the run
+struct BenchStats
+{
+    std::vector<uint32_t> latencies[COMMAND_COUNT]; // in us
+    size_t errors[COMMAND_COUNT] = {};             // ERR replies
+    size_t failures = 0;                           // lost connections
+};
+
+class BenchConnection
+{
+public:
+    ~BenchConnection()
+    {
+        disconnect();
+    }
+
+    bool connect_to(const std::string &ip, int port)
+    {
+        disconnect();
+        socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (socket_fd == -1)
+        {
+            return false;
+        }
+
+        struct sockaddr_in server_addr = {};
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(port);
+        if (inet_aton(ip.c_str(), &server_addr.sin_addr) == 0 ||
+            connect(socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1)
+        {
+            disconnect();
+            return false;
+        }
+        response_parser = std::make_unique<FrameParser>(false); // nothing left over from the last connection
+        return true;
+    }
+
+    void disconnect()
+    {
+        if (socket_fd != -1)
+        {
+            close(socket_fd);
+            socket_fd = -1;
+        }
+    }
+
+    // Sends one frame and waits for its reply, false if the connection broke
+    bool request(const std::string &frame, std::string &reply)
+    {
+        size_t sent = 0;
+        while (sent < frame.size())
+        {
+            ssize_t result = send(socket_fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            sent += result;
+        }
+
+        Frame response;
+        FrameParser::Status status;
+        while ((status = response_parser->next(response)) == FrameParser::Status::NeedMore)
+        {
+            char *buffer = response_parser->write_ptr(16384);
+            ssize_t received = recv(socket_fd, buffer, response_parser->writable(), 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                return false;
+            response_parser->commit(received);
+        }
+        if (status == FrameParser::Status::Invalid)
+        {
+            return false;
+        }
+        reply.assign(response.body.data(), response.body.size());
+        return true;
+    }
+
+private:
+    int socket_fd = -1;
+    std::unique_ptr<FrameParser> response_parser;
+};
+
+static bool parse_mix(const std::string &mix, int weights[COMMAND_COUNT])
+{
+    std::fill(weights, weights + COMMAND_COUNT, 0);
+    std::istringstream items(mix);
+    std::string item;
+    while (std::getline(items, item, ','))
+    {
+        size_t separator = item.find('=');
+        if (separator == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = item.substr(0, separator);
+        std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+        auto known = std::find_if(std::begin(COMMAND_NAMES), std::end(COMMAND_NAMES), [&](const char *command)
+                                  { return name == command; });
+        int weight = std::atoi(item.c_str() + separator + 1);
+        if (known == std::end(COMMAND_NAMES) || weight < 0)
+        {
+            return false;
+        }
+        weights[known - std::begin(COMMAND_NAMES)] = weight;
+    }
+    return std::any_of(weights, weights + COMMAND_COUNT, [](int weight)
+                       { return weight > 0; });
+}
+
+// message_size bytes of text in lines of at most 72 characters
+static std::string build_message(size_t message_size)
+{
+    std::string message;
+    message.reserve(message_size + message_size / 72 + 1);
+    for (size_t written = 0; written < message_size;)
+    {
+        size_t length = std::min<size_t>(72, message_size - written);
+        message.append(length, 'x').append("\n");
+        written += length;
+    }
+    return message;
+}
+
+// Ids of a LIST reply: count line, then "[<id>] <subject>" per message
+static void parse_list(const std::string &reply, std::vector<std::string> &ids)
+{
+    ids.clear();
+    std::istringstream lines(reply);
+    std::string line;
+    std::getline(lines, line);
+    while (std::getline(lines, line))
+    {
+        size_t end = line.find(']');
+        if (line.size() > 1 && line[0] == '[' && end != std::string::npos)
+        {
+            ids.push_back(line.substr(1, end - 1));
+        }
+    }
+}
+
+static std::string login_frame(const std::string &username, const std::string &password)
+{
+    CommandBuilder builder;
+    builder.add_parameter(username);
+    builder.add_parameter(password);
+    return builder.build_final_cmd("LOGIN");
+}
+
+static void run_connection(const BenchOptions &options, int index, std::chrono::steady_clock::time_point deadline, BenchStats &stats)
+{
+    using clock = std::chrono::steady_clock;
+
+    int users = options.users > 0 ? options.users : options.connections;
+    std::string username = options.user + std::to_string(index % users);
+    std::string message = build_message(options.message_size);
+    std::mt19937 random(index);
+    std::discrete_distribution<int> pick(std::begin(options.weights), std::end(options.weights));
+
+    BenchConnection connection;
+    std::vector<std::string> ids;
+    std::string reply;
+    size_t sent_messages = 0;
+    bool connected = false;
+
+    // times a single request, an ERR reply counts as error but keeps the connection
+    auto timed = [&](Command command, const std::string &frame)
+    {
+        auto start = clock::now();
+        if (!connection.request(frame, reply))
+        {
+            stats.failures++;
+            connected = false;
+            return false;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+        stats.latencies[command].push_back(elapsed.count());
+        if (reply.compare(0, 3, "ERR") == 0)
+        {
+            stats.errors[command]++;
+        }
+        return true;
+    };
+
+    auto log_in = [&]()
+    {
+        connected = connection.connect_to(options.ip, options.port);
+        if (!connected)
+        {
+            stats.failures++;
+            return;
+        }
+        if (timed(LOGIN, login_frame(username, options.password)) && reply.compare(0, 2, "OK") != 0)
+        {
+            connected = false; // without a session the other commands only measure rejections
+        }
+    };
+
+    while (clock::now() < deadline)
+    {
+        if (!connected)
+        {
+            log_in();
+            if (!connected)
+            {
+                // the server is gone or refuses us, do not spin
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+
+        Command command = static_cast<Command>(pick(random));
+        if ((command == READ || command == DEL) && ids.empty())
+        {
+            // nothing known to read yet: look it up without counting the LIST
+            if (!connection.request(CommandBuilder().build_final_cmd("LIST"), reply))
+            {
+                stats.failures++;
+                connected = false;
+                continue;
+            }
+            parse_list(reply, ids);
+            if (ids.empty())
+            {
+                command = SEND;
+            }
+        }
+
+        CommandBuilder builder;
+        switch (command)
+        {
+        case LOGIN:
+            log_in();
+            break;
+        case SEND:
+            builder.add_parameter(username);
+            builder.add_parameter("bench " + std::to_string(index) + "-" + std::to_string(sent_messages++));
+            builder.add_msg_content(message);
+            timed(SEND, builder.build_final_cmd("SEND"));
+            break;
+        case LIST:
+            if (timed(LIST, builder.build_final_cmd("LIST")))
+            {
+                parse_list(reply, ids);
+            }
+            break;
+        case READ:
+            builder.add_parameter(ids[random() % ids.size()]);
+            timed(READ, builder.build_final_cmd("READ"));
+            break;
+        case DEL:
+        {
+            size_t position = random() % ids.size();
+            builder.add_parameter(ids[position]);
+            ids.erase(ids.begin() + position);
+            timed(DEL, builder.build_final_cmd("DEL"));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+// Value below which fraction of the sorted latencies fall
+static double percentile(const std::vector<uint32_t> &sorted, double fraction)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+    return sorted[std::max<size_t>(rank, 1) - 1] / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *usage = "Usage: ./twmailer-bench <ip> <port> [--connections n] [--duration s] "
+                        "[--mix login=1,send=4,list=3,read=3,del=1] [--size bytes] "
+                        "[--user prefix] [--users n] [--password pw]";
+    if (argc < 3)
+    {
+        std::cout << usage << "\n";
+        return EXIT_FAILURE;
+    }
+
+    BenchOptions options;
+    options.ip = argv[1];
+    try
+    {
+        options.port = std::stoi(argv[2]);
+        for (int i = 3; i < argc; i += 2)
+        {
+            std::string option = argv[i];
+            if (i + 1 >= argc)
+            {
+                throw std::invalid_argument(option);
+            }
+            std::string value = argv[i + 1];
+
+            if (option == "--connections")
+                options.connections = std::stoi(value);
+            else if (option == "--duration")
+                options.duration = std::stoi(value);
+            else if (option == "--size")
+                options.message_size = std::stoul(value);
+            else if (option == "--user")
+                options.user = value;
+            else if (option == "--users")
+                options.users = std::stoi(value);
+            else if (option == "--password")
+                options.password = value;
+            else if (option != "--mix" || !parse_mix(value, options.weights))
+                throw std::invalid_argument(option);
+        }
+        if (options.connections < 1 || options.duration < 1 || options.users < 0 || options.user.empty())
+        {
+            throw std::invalid_argument("value out of range");
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Invalid arguments (" << e.what() << ")\n" << usage << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "connections: " << options.connections << ", duration: " << options.duration
+              << " s, message size: " << options.message_size << " B\n";
+
+    std::vector<BenchStats> stats(options.connections);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(options.duration);
+    for (int i = 0; i < options.connections; i++)
+    {
+        threads.emplace_back(run_connection, std::cref(options), i, deadline, std::ref(stats[i]));
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    BenchStats total;
+    for (auto &connection_stats : stats)
+    {
+        for (int command = 0; command < COMMAND_COUNT; command++)
+        {
+            auto &latencies = connection_stats.latencies[command];
+            total.latencies[command].insert(total.latencies[command].end(), latencies.begin(), latencies.end());
+            total.errors[command] += connection_stats.errors[command];
+        }
+        total.failures += connection_stats.failures;
+    }
+
+    std::cout << std::left << std::setw(8) << "command" << std::right
+              << std::setw(10) << "count" << std::setw(8) << "errors" << std::setw(12) << "req/s"
+              << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "p999 ms" << std::setw(10) << "max ms" << "\n";
+
+    size_t requests = 0;
+    std::cout << std::fixed << std::setprecision(3);
+    for (int command = 0; command < COMMAND_COUNT; command++)
+    {
+        auto &latencies = total.latencies[command];
+        std::sort(latencies.begin(), latencies.end());
+        requests += latencies.size();
+        std::cout << std::left << std::setw(8) << COMMAND_NAMES[command] << std::right
+                  << std::setw(10) << latencies.size() << std::setw(8) << total.errors[command]
+                  << std::setw(12) << std::setprecision(1) << latencies.size() / seconds << std::setprecision(3)
+                  << std::setw(10) << percentile(latencies, 0.50) << std::setw(10) << percentile(latencies, 0.99)
+                  << std::setw(10) << percentile(latencies, 0.999) << std::setw(10) << percentile(latencies, 1.0) << "\n";
+    }
+
+    std::cout << std::setprecision(1) << "total: " << requests << " requests in " << seconds << " s, "
+              << requests / seconds << " req/s";
+    if (total.failures > 0)
+    {
+        std::cout << ", " << total.failures << " connection failures";
+    }
+    std::cout << "\n";
+    return EXIT_SUCCESS;
+}
@@ -14,8 +14,7 @@ void CommandBuilder::add_msg_content()
 
     while (true)
     {
-        std::getline(std::cin, line);
-        if (line == ".")
+        if (!std::getline(std::cin, line) || line == ".")
         {
             message_lines.push_back(".\n");
             break;
@@ -24,6 +23,17 @@ void CommandBuilder::add_msg_content()
     }
 }
 
+void CommandBuilder::add_msg_content(const std::string &content)
+{
+    std::istringstream lines(content);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        message_lines.push_back(line + "\n");
+    }
+    message_lines.push_back(".\n");
+}
+
 std::string CommandBuilder::build_final_cmd(const std::string &cmd_name)
 {
     std::ostringstream cmd_stream;
@@ -2,6 +2,7 @@
 #define COMMANDBUILDER
 
 #include <iostream>
+#include <string>
 #include <vector>
 
 class CommandBuilder {
@@ -11,6 +12,8 @@ public:
     
     void add_parameter(const std::string& param);
     void add_msg_content();
+    // Same without the prompt: content lines are split at '\n', the "." is added
+    void add_msg_content(const std::string& content);
     std::string build_final_cmd(const std::string &commandName);
     
 private:
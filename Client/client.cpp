@@ -1,7 +1,10 @@
 #include "client.h"
+#include <cerrno>
+#include <deque>
 #include <iostream>
 #include <string>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <sstream>
@@ -12,6 +15,7 @@ Client::Client(const std::string &ip, int port)
 : ip_address(ip)
 , port(port)
 , socket_fd(-1)
+, response_parser(false)
 {
   init_socket();
   init_function_routing();
@@ -33,6 +37,13 @@ void Client::start()
   handle_user_input();
 }
 
+// Method to run a batch script over one connection
+bool Client::start_batch(std::istream &script)
+{
+  connect_to_server();
+  return run_pipeline(script);
+}
+
 // Method to initialize the socket
 void Client::init_socket()
 {
@@ -90,6 +101,12 @@ void Client::handle_user_input()
   while (true)
   {
     get_user_input(">", input);
+    if (!std::cin)
+    {
+      // end of input: leave like QUIT instead of prompting forever
+      handle_quit();
+      return;
+    }
 
     if (command_map.find(input) != command_map.end())
     {
@@ -117,50 +134,31 @@ void Client::send_command(const std::string &command)
 // Method to handle responses from the server
 void Client::handle_response()
 {
-  std::string response; // To hold the full response
-  ssize_t init_size = GenericConstants::STD_BUFFER_SIZE;
-  char *buffer = new char[init_size]; // temporary buffer for chunks to be read in incrementally
+  Frame frame;
+  FrameParser::Status status;
 
-  ssize_t total_received = recv(socket_fd, buffer, init_size - 1, 0);
-  if (total_received <= 0)
+  // keep receiving until one complete response is buffered, leftovers stay for the next call
+  while ((status = response_parser.next(frame)) == FrameParser::Status::NeedMore)
   {
-    std::cout << "Receive error or connection closed.\n";
-    return;
-  }
-
-  buffer[total_received] = '\0';
-
-  std::istringstream stream(buffer);
-
-  int content_length;
-  std::string content_length_header;
-  std::getline(stream, content_length_header);
-
-  if (check_content_length_header(content_length_header, content_length))
-  {
-    int message_length = content_length_header.size() + content_length + 1;
-    if (message_length > total_received)
+    char *buffer = response_parser.write_ptr(GenericConstants::STD_BUFFER_SIZE);
+    ssize_t received = recv(socket_fd, buffer, response_parser.writable(), 0);
+    if (received <= 0)
     {
-      resize_buffer(buffer, init_size, message_length + 1);
-
-      ssize_t remaining = message_length - total_received;
-      ssize_t received = recv(socket_fd, &buffer[total_received], remaining, 0);
-
-      total_received += received;
-      buffer[total_received] = '\0';
+      std::cout << "Receive error or connection closed.\n";
+      return;
     }
-
-    // Skip the first line (content-length header) and print the rest
-    const char *body_start = buffer + content_length_header.size() + 1;
-    std::cout << "\nServer Response:" << std::endl;
-    std::cout << body_start << std::endl;
+    response_parser.commit(received);
   }
-  else
+
+  if (status == FrameParser::Status::Invalid)
   {
     std::cout << "Received response with invalid format" << std::endl;
+    return;
   }
 
-  delete[] buffer;
+  // print the body without the content-length header
+  std::cout << "\nServer Response:" << std::endl;
+  std::cout << frame.body << std::endl;
 }
 
 void Client::handle_login()
@@ -236,3 +234,190 @@ void Client::handle_quit()
   std::string cmd = builder.build_final_cmd("QUIT");
   send_command(cmd);
 }
+
+// Reads the next request of a batch script: the command followed by the lines
+// the interactive prompts ask for, for SEND the message lines up to ".". Empty
+// lines and lines starting with '#' between requests are skipped.
+// Returns false at the end of the script; a malformed request leaves frame empty.
+bool Client::next_batch_request(std::istream &script, std::string &frame, std::string &label)
+{
+  std::string command;
+  do
+  {
+    if (!std::getline(script, command))
+    {
+      return false;
+    }
+  } while (command.empty() || command[0] == '#');
+
+  frame.clear();
+  label = command;
+
+  int parameter_count;
+  if (command == "LOGIN" || command == "SEND")
+    parameter_count = 2;
+  else if (command == "READ" || command == "DEL")
+    parameter_count = 1;
+  else if (command == "LIST" || command == "QUIT")
+    parameter_count = 0;
+  else
+  {
+    std::cout << "Unknown command in batch script: " << command << "\n";
+    return true;
+  }
+
+  CommandBuilder builder;
+  std::string line;
+  for (int i = 0; i < parameter_count; i++)
+  {
+    if (!std::getline(script, line))
+    {
+      std::cout << "Batch script ends inside " << command << "\n";
+      return true;
+    }
+    builder.add_parameter(line);
+    if (i == 0)
+    {
+      label += " " + line; // user, receiver or message number, never the password
+    }
+  }
+
+  if (command == "SEND")
+  {
+    std::string content;
+    while (std::getline(script, line) && line != ".")
+    {
+      content += line + "\n";
+    }
+    if (line != ".")
+    {
+      std::cout << "Batch script ends inside the message of " << label << "\n";
+      return true;
+    }
+    builder.add_msg_content(content);
+  }
+
+  frame = builder.build_final_cmd(command);
+  return true;
+}
+
+// Sends the requests of the script without waiting for each reply. The server
+// answers the frames of a connection in order, so replies are matched to the
+// requests by position. Sending and receiving run interleaved under poll():
+// the server stops reading while its replies are not picked up, a client that
+// only sends would block forever on the full socket.
+bool Client::run_pipeline(std::istream &script)
+{
+  std::string outgoing; // built requests, sent up to outgoing_sent
+  size_t outgoing_sent = 0;
+  std::deque<std::string> labels; // requests waiting for their reply, oldest first
+  size_t answered = 0;
+  size_t failed = 0;
+  bool script_done = false;
+  bool connection_lost = false;
+  std::string frame, label;
+
+  while (true)
+  {
+    // build requests ahead of the replies, bounded so long scripts are streamed
+    while (!script_done && outgoing.size() - outgoing_sent < ClientConstants::BATCH_SEND_AHEAD)
+    {
+      if (!next_batch_request(script, frame, label))
+      {
+        script_done = true;
+        break;
+      }
+      if (frame.empty())
+      {
+        failed++;
+        continue;
+      }
+      outgoing += frame;
+      if (label == "QUIT")
+      {
+        script_done = true; // the server closes the connection without a reply
+        break;
+      }
+      labels.push_back(label);
+    }
+
+    if (script_done && outgoing_sent == outgoing.size() && labels.empty())
+      break;
+
+    struct pollfd poll_fd = {socket_fd, POLLIN, 0};
+    if (outgoing_sent < outgoing.size())
+      poll_fd.events |= POLLOUT;
+    if (poll(&poll_fd, 1, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      std::cout << "poll failed\n";
+      connection_lost = true;
+      break;
+    }
+
+    if (poll_fd.revents & POLLOUT)
+    {
+      ssize_t result = send(socket_fd, outgoing.data() + outgoing_sent, outgoing.size() - outgoing_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (result == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      {
+        std::cout << "Sending failed\n";
+        connection_lost = true;
+        break;
+      }
+      if (result > 0)
+        outgoing_sent += result;
+      if (outgoing_sent == outgoing.size() || outgoing_sent >= ClientConstants::BATCH_SEND_AHEAD)
+      {
+        outgoing.erase(0, outgoing_sent);
+        outgoing_sent = 0;
+      }
+    }
+
+    if (poll_fd.revents & (POLLIN | POLLHUP | POLLERR))
+    {
+      char *buffer = response_parser.write_ptr(ClientConstants::RECV_CHUNK_SIZE);
+      ssize_t received = recv(socket_fd, buffer, response_parser.writable(), MSG_DONTWAIT);
+      if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        continue;
+      if (received <= 0)
+      {
+        std::cout << "Receive error or connection closed.\n";
+        connection_lost = true;
+        break;
+      }
+      response_parser.commit(received);
+
+      Frame response;
+      FrameParser::Status status;
+      while ((status = response_parser.next(response)) == FrameParser::Status::Complete)
+      {
+        if (labels.empty())
+        {
+          std::cout << "Received a response without a request\n";
+          return false;
+        }
+        answered++;
+        std::cout << "[" << answered << "] " << labels.front() << "\n" << response.body;
+        if (response.body.empty() || response.body.back() != '\n')
+          std::cout << "\n";
+        if (response.body.substr(0, 3) == "ERR" || response.body.substr(0, 12) == "Unauthorized")
+          failed++;
+        labels.pop_front();
+      }
+      if (status == FrameParser::Status::Invalid)
+      {
+        std::cout << "Received response with invalid format\n";
+        return false;
+      }
+    }
+  }
+
+  std::cout << "Batch finished: " << answered << " responses, " << failed << " failed";
+  if (connection_lost)
+  {
+    std::cout << ", " << labels.size() << " requests unanswered";
+  }
+  std::cout << std::endl;
+  return failed == 0 && !connection_lost;
+}
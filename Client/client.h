@@ -2,10 +2,12 @@
 #define CLIENT_H
 
 #include <functional>
+#include <istream>
 #include <string>
 #include <unordered_map>
 #include "CommandBuilder/command_builder.h"
 #include "../utils/helpers.h"
+#include "../utils/frame_parser.h"
 
 class Client
 {
@@ -19,11 +21,16 @@ public:
     // Public method to start the client
     void start();
 
+    // Batch mode: runs the commands of a script instead of prompting for them.
+    // Returns false if a request failed or the script was malformed.
+    bool start_batch(std::istream &script);
+
 private:
     std::string ip_address;
     int port;
     int socket_fd;
     std::unordered_map<std::string, std::function<void()>> command_map; // function hashmap
+    FrameParser response_parser; // server responses have no command line
 
     // Private methods for internal functionality
     void init_socket();
@@ -38,6 +45,10 @@ private:
     void handle_read();
     void handle_delete();
     void handle_quit();
+
+    // Batch mode
+    bool next_batch_request(std::istream &script, std::string &frame, std::string &label);
+    bool run_pipeline(std::istream &script);
 };
 
 #endif // CLIENT_H
@@ -1,11 +1,13 @@
 #include "client.h"
+#include <fstream>
 #include <iostream>
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    // --batch runs a script (file or "-" for stdin) instead of prompting
+    if (argc != 3 && !(argc == 5 && std::string(argv[3]) == "--batch"))
     {
-        std::cout << "Usage: ./twmailer-client <ip> <port>" << std::endl;
+        std::cout << "Usage: ./twmailer-client <ip> <port> [--batch <script>|-]" << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -15,6 +17,22 @@ int main(int argc, char *argv[])
     try
     {
         Client client_instance(ip, port);
+        if (argc == 5)
+        {
+            std::string script_path = argv[4];
+            if (script_path == "-")
+            {
+                return client_instance.start_batch(std::cin) ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+
+            std::ifstream script(script_path);
+            if (!script.is_open())
+            {
+                std::cout << "Unable to open batch script " << script_path << std::endl;
+                return EXIT_FAILURE;
+            }
+            return client_instance.start_batch(script) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
         client_instance.start();
     }
     catch (const std::exception &e)
@@ -0,0 +1,425 @@
+#include "auth_cache.h"
+#include "password_hash.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../../utils/log.h"
+
+static int64_t steady_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+namespace
+{
+// A lookup running on the hashing threads, its eventfd becomes readable once
+// the answer is set. The outcome is shared with the job, so an abandoned
+// attempt can be destroyed while the hash is still being computed.
+class CacheLookup : public AuthAttempt
+{
+public:
+    struct Outcome
+    {
+        int event_fd = -1;
+        std::atomic<AuthStatus> status{AuthStatus::Pending};
+
+        ~Outcome()
+        {
+            if (event_fd != -1)
+            {
+                close(event_fd);
+            }
+        }
+    };
+
+    explicit CacheLookup(std::shared_ptr<Outcome> outcome)
+    : outcome(std::move(outcome))
+    {}
+
+    int descriptor() const override { return outcome->event_fd; }
+    AuthStatus poll() override { return outcome->status.load(std::memory_order_acquire); }
+
+private:
+    std::shared_ptr<Outcome> outcome;
+};
+}
+
+AuthCache::AuthCache(const AuthCacheConfig &config)
+: config(config)
+{
+    if (config.size == 0)
+    {
+        return;
+    }
+
+    bucket_count = 1;
+    while (bucket_count < config.size)
+    {
+        bucket_count *= 2;
+    }
+
+    size_t entries_offset = sizeof(Shared) + bucket_count * sizeof(uint32_t);
+    entries_offset = (entries_offset + alignof(Entry) - 1) / alignof(Entry) * alignof(Entry);
+    mapped_size = entries_offset + config.size * sizeof(Entry);
+
+    // shared before the first fork, so every handler sees the same table
+    void *memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        throw std::runtime_error("Unable to map the authentication cache: " + std::to_string(errno));
+    }
+
+    char *base = static_cast<char *>(memory);
+    shared = new (base) Shared();
+    buckets = reinterpret_cast<uint32_t *>(base + sizeof(Shared));
+    entries = reinterpret_cast<Entry *>(base + entries_offset);
+
+    pthread_mutexattr_t attributes;
+    bool initialized = pthread_mutexattr_init(&attributes) == 0;
+    initialized = initialized && pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED) == 0 &&
+                  pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST) == 0 &&
+                  pthread_mutex_init(&shared->lock, &attributes) == 0;
+    pthread_mutexattr_destroy(&attributes);
+    if (!initialized)
+    {
+        munmap(memory, mapped_size);
+        throw std::runtime_error("Mutex initialization failed for the authentication cache");
+    }
+    clear();
+
+    LOG_INFO("Authentication cache with " << config.size << " entries, TTL " << config.positive_ttl
+             << " sec (rejections " << config.negative_ttl << " sec)");
+}
+
+AuthCache::~AuthCache()
+{
+    {
+        std::lock_guard<std::mutex> guard(jobs_mutex);
+        stopping = true;
+    }
+    jobs_ready.notify_all();
+    for (std::thread &thread : hash_threads)
+    {
+        thread.join();
+    }
+
+    if (shared != nullptr)
+    {
+        munmap(shared, mapped_size);
+    }
+}
+
+// Every entry free, nothing in the hash chains or the LRU list
+void AuthCache::clear()
+{
+    shared->newest = NONE;
+    shared->oldest = NONE;
+    for (size_t i = 0; i < bucket_count; i++)
+    {
+        buckets[i] = NONE;
+    }
+    for (size_t i = 0; i < config.size; i++)
+    {
+        entries[i].chain = i + 1 < config.size ? i + 1 : NONE;
+    }
+    shared->free_list = 0;
+}
+
+AuthCache::Result AuthCache::lookup(const std::string &username, const std::string &password)
+{
+    if (shared == nullptr)
+    {
+        return Result::Miss;
+    }
+    Candidate candidates[2];
+    int count = find_candidates(username, candidates);
+    return verify(username, password, candidates, count);
+}
+
+std::unique_ptr<AuthAttempt> AuthCache::start_lookup(const std::string &username, const std::string &password)
+{
+    if (shared == nullptr)
+    {
+        return nullptr;
+    }
+    // most misses are users without any entry, they need no hashing at all
+    Candidate candidates[2];
+    int count = find_candidates(username, candidates);
+    if (count == 0)
+    {
+        shared->misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    auto outcome = std::make_shared<CacheLookup::Outcome>();
+    outcome->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (outcome->event_fd == -1)
+    {
+        LOG_ERROR("Unable to create an eventfd for the authentication cache: " << std::strerror(errno));
+        shared->misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    std::vector<Candidate> copies(candidates, candidates + count);
+    run_later([this, outcome, username, password, copies]
+    {
+        Result result = verify(username, password, copies.data(), copies.size());
+        AuthStatus status = result == Result::Accepted ? AuthStatus::Accepted : result == Result::Rejected ? AuthStatus::Rejected : AuthStatus::Miss;
+        outcome->status.store(status, std::memory_order_release);
+        uint64_t one = 1;
+        if (write(outcome->event_fd, &one, sizeof(one)) != sizeof(one))
+        {
+            LOG_ERROR("Unable to signal a finished authentication cache lookup");
+        }
+    });
+    return std::unique_ptr<AuthAttempt>(new CacheLookup(outcome));
+}
+
+// Copies the unexpired entries of username into candidates, unlinks expired ones
+int AuthCache::find_candidates(const std::string &username, Candidate (&candidates)[2])
+{
+    if (username.size() >= USERNAME_SIZE)
+    {
+        return 0;
+    }
+
+    int count = 0;
+    int64_t now = steady_now();
+    lock();
+    for (bool accepted : {true, false})
+    {
+        uint32_t index = find(username, accepted);
+        if (index == NONE)
+        {
+            continue;
+        }
+        if (entries[index].expires <= now)
+        {
+            unlink(index);
+            continue;
+        }
+        std::memcpy(candidates[count].hash, entries[index].hash, HASH_SIZE);
+        candidates[count].accepted = accepted;
+        count++;
+    }
+    unlock();
+    return count;
+}
+
+AuthCache::Result AuthCache::verify(const std::string &username, const std::string &password, const Candidate *candidates, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (!verify_password(password, candidates[i].hash))
+        {
+            continue;
+        }
+
+        lock();
+        uint32_t index = find(username, candidates[i].accepted);
+        if (index != NONE && std::strcmp(entries[index].hash, candidates[i].hash) == 0)
+        {
+            make_newest(index);
+        }
+        unlock();
+
+        shared->hits.fetch_add(1, std::memory_order_relaxed);
+        return candidates[i].accepted ? Result::Accepted : Result::Rejected;
+    }
+
+    shared->misses.fetch_add(1, std::memory_order_relaxed);
+    return Result::Miss;
+}
+
+void AuthCache::store(const std::string &username, const std::string &password, bool accepted)
+{
+    if (shared == nullptr || username.size() >= USERNAME_SIZE)
+    {
+        return;
+    }
+
+    std::string hashed = hash_password(password);
+    if (hashed.empty() || hashed.size() >= HASH_SIZE)
+    {
+        LOG_ERROR("Unable to hash password for the authentication cache");
+        return;
+    }
+
+    int ttl = accepted ? config.positive_ttl : config.negative_ttl;
+    int64_t expires = steady_now() + static_cast<int64_t>(ttl) * 1000000000;
+
+    lock();
+    uint32_t index = find(username, accepted);
+    if (index == NONE)
+    {
+        if (shared->free_list == NONE)
+        {
+            unlink(shared->oldest); // full: evict the least recently used entry
+        }
+        index = shared->free_list;
+        shared->free_list = entries[index].chain;
+
+        Entry &entry = entries[index];
+        std::memcpy(entry.username, username.c_str(), username.size() + 1);
+        entry.accepted = accepted;
+        entry.newer = NONE;
+        entry.older = NONE;
+
+        uint32_t &head = bucket(username, accepted);
+        entry.chain = head;
+        head = index;
+    }
+    std::memcpy(entries[index].hash, hashed.c_str(), hashed.size() + 1);
+    entries[index].expires = expires;
+    make_newest(index);
+    unlock();
+}
+
+void AuthCache::store_later(const std::string &username, const std::string &password, bool accepted)
+{
+    if (shared == nullptr || username.size() >= USERNAME_SIZE)
+    {
+        return;
+    }
+    run_later([this, username, password, accepted]
+    {
+        store(username, password, accepted);
+    });
+}
+
+void AuthCache::run_later(std::function<void()> job)
+{
+    std::call_once(hash_threads_started, [this]
+    {
+        for (int i = 0; i < ServerConstants::AUTH_HASH_THREADS; i++)
+        {
+            hash_threads.emplace_back(&AuthCache::run_hash_jobs, this);
+        }
+    });
+    {
+        std::lock_guard<std::mutex> guard(jobs_mutex);
+        jobs.push_back(std::move(job));
+    }
+    jobs_ready.notify_one();
+}
+
+// Queued jobs are still finished when the cache is destroyed
+void AuthCache::run_hash_jobs()
+{
+    for (;;)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> guard(jobs_mutex);
+            jobs_ready.wait(guard, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+            {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+unsigned long AuthCache::hits() const
+{
+    return shared != nullptr ? shared->hits.load(std::memory_order_relaxed) : 0;
+}
+
+unsigned long AuthCache::misses() const
+{
+    return shared != nullptr ? shared->misses.load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t &AuthCache::bucket(const std::string &username, bool accepted)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : username)
+    {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    hash = (hash ^ (accepted ? 1 : 0)) * 1099511628211ULL;
+    return buckets[hash & (bucket_count - 1)];
+}
+
+uint32_t AuthCache::find(const std::string &username, bool accepted)
+{
+    for (uint32_t index = bucket(username, accepted); index != NONE; index = entries[index].chain)
+    {
+        if (entries[index].accepted == accepted && username == entries[index].username)
+        {
+            return index;
+        }
+    }
+    return NONE;
+}
+
+// Removes the entry from its hash chain and the LRU list and frees it
+void AuthCache::unlink(uint32_t index)
+{
+    Entry &entry = entries[index];
+    uint32_t *link = &bucket(entry.username, entry.accepted);
+    while (*link != index)
+    {
+        link = &entries[*link].chain;
+    }
+    *link = entry.chain;
+
+    (entry.newer != NONE ? entries[entry.newer].older : shared->newest) = entry.older;
+    (entry.older != NONE ? entries[entry.older].newer : shared->oldest) = entry.newer;
+
+    entry.chain = shared->free_list;
+    shared->free_list = index;
+}
+
+void AuthCache::make_newest(uint32_t index)
+{
+    Entry &entry = entries[index];
+    if (shared->newest == index)
+    {
+        return;
+    }
+
+    // detach, unless the entry was just allocated and is not in the list yet
+    if (entry.newer != NONE)
+    {
+        (entry.newer != NONE ? entries[entry.newer].older : shared->newest) = entry.older;
+        (entry.older != NONE ? entries[entry.older].newer : shared->oldest) = entry.newer;
+    }
+
+    entry.newer = NONE;
+    entry.older = shared->newest;
+    if (shared->newest != NONE)
+    {
+        entries[shared->newest].newer = index;
+    }
+    shared->newest = index;
+    if (shared->oldest == NONE)
+    {
+        shared->oldest = index;
+    }
+}
+
+void AuthCache::lock()
+{
+    if (pthread_mutex_lock(&shared->lock) == EOWNERDEAD)
+    {
+        // the owner died in the middle of an update, the links may be broken
+        LOG_WARNING("A process died while holding the authentication cache lock, clearing the cache");
+        clear();
+        pthread_mutex_consistent(&shared->lock);
+    }
+}
+
+void AuthCache::unlock()
+{
+    pthread_mutex_unlock(&shared->lock);
+}
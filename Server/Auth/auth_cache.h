@@ -0,0 +1,131 @@
+#ifndef AUTH_CACHE_H
+#define AUTH_CACHE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "authenticator.h"
+#include "../../utils/constants.h"
+
+struct AuthCacheConfig
+{
+    size_t size = ServerConstants::AUTH_CACHE_SIZE;               // entries, 0 disables the cache
+    int positive_ttl = ServerConstants::AUTH_CACHE_TTL;           // in sec, accepted passwords
+    int negative_ttl = ServerConstants::AUTH_CACHE_NEGATIVE_TTL;  // in sec, rejected passwords
+};
+
+// Remembers recent answers of the directory so repeated logins skip the bind.
+//
+// An entry holds a salted SHA-512 crypt hash of the password, never the password
+// itself, and whether the directory accepted or rejected it. A user has at most
+// one accepted and one rejected entry. Rejections are only cached briefly so a
+// password change takes effect quickly.
+//
+// The table lives in anonymous shared memory created before the server forks,
+// so forked handlers and worker threads share entries and counters. Entries are
+// a fixed array linked into hash chains and an LRU list by index. The lock is a
+// robust process-shared mutex: a handler killed while holding it leaves the
+// table possibly half updated, the next locker empties it and carries on.
+//
+// Hashing costs milliseconds (SHA-512 crypt, 5000 rounds). Forked handlers call
+// lookup() and store() directly, the event loops use start_lookup() and
+// store_later(), which hash on AUTH_HASH_THREADS threads of their own.
+class AuthCache
+{
+public:
+    enum class Result { Miss, Accepted, Rejected };
+
+    explicit AuthCache(const AuthCacheConfig &config = AuthCacheConfig());
+    ~AuthCache();
+
+    AuthCache(const AuthCache &) = delete;
+    AuthCache &operator=(const AuthCache &) = delete;
+
+    // Costs one slow hash per entry of the user, done outside the lock
+    Result lookup(const std::string &username, const std::string &password);
+
+    // lookup() on the hashing threads. The attempt answers Accepted, Rejected
+    // or Miss; nullptr is a miss known right away, e.g. no entry for the user.
+    std::unique_ptr<AuthAttempt> start_lookup(const std::string &username, const std::string &password);
+
+    // Records what the directory answered for username and password
+    void store(const std::string &username, const std::string &password, bool accepted);
+
+    // store() on the hashing threads, returns right away
+    void store_later(const std::string &username, const std::string &password, bool accepted);
+
+    unsigned long hits() const;
+    unsigned long misses() const;
+
+private:
+    static constexpr size_t USERNAME_SIZE = 64; // longer names are not cached
+    static constexpr size_t HASH_SIZE = 128;    // "$6$rounds=N$<salt>$<hash>"
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Entry
+    {
+        char username[USERNAME_SIZE];
+        char hash[HASH_SIZE];
+        bool accepted;
+        int64_t expires; // steady clock, the same in every process
+        uint32_t chain;  // next entry in the same bucket
+        uint32_t newer;  // LRU neighbours
+        uint32_t older;
+    };
+
+    struct Shared
+    {
+        pthread_mutex_t lock;
+        std::atomic<unsigned long> hits;
+        std::atomic<unsigned long> misses;
+        uint32_t newest;
+        uint32_t oldest;
+        uint32_t free_list; // chained through Entry::chain
+    };
+
+    // unexpired entries of a user, copied so the slow hashing runs without the lock
+    struct Candidate
+    {
+        char hash[HASH_SIZE];
+        bool accepted;
+    };
+
+    AuthCacheConfig config;
+    size_t bucket_count = 0;
+    size_t mapped_size = 0;
+    Shared *shared = nullptr;
+    uint32_t *buckets = nullptr;
+    Entry *entries = nullptr;
+
+    // hashing threads, started on first use. Not inherited by forked handlers.
+    std::once_flag hash_threads_started;
+    std::vector<std::thread> hash_threads;
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_ready;
+    std::deque<std::function<void()>> jobs;
+    bool stopping = false;
+
+    int find_candidates(const std::string &username, Candidate (&candidates)[2]);
+    Result verify(const std::string &username, const std::string &password, const Candidate *candidates, int count);
+    void run_later(std::function<void()> job);
+    void run_hash_jobs();
+    void clear();
+
+    uint32_t &bucket(const std::string &username, bool accepted);
+    uint32_t find(const std::string &username, bool accepted);
+    void unlink(uint32_t index);
+    void make_newest(uint32_t index);
+    void lock();
+    void unlock();
+};
+
+#endif // AUTH_CACHE_H
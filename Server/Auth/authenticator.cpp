@@ -0,0 +1,18 @@
+#include "authenticator.h"
+#include "file_authenticator.h"
+#include "ldap_authenticator.h"
+#include "mock_authenticator.h"
+
+std::unique_ptr<Authenticator> create_authenticator(const AuthConfig &config)
+{
+    switch (config.method)
+    {
+    case AuthMethod::File:
+        return std::unique_ptr<Authenticator>(new FileAuthenticator(config.user_file));
+    case AuthMethod::Mock:
+        return std::unique_ptr<Authenticator>(new MockAuthenticator(config.mock_latency));
+    case AuthMethod::Ldap:
+    default:
+        return std::unique_ptr<Authenticator>(new LdapAuthenticator(config.ldap));
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef AUTHENTICATOR_H
+#define AUTHENTICATOR_H
+
+#include <memory>
+#include <string>
+#include "../LdapModule/ldap_pool.h"
+
+// Who checks the credentials of a LOGIN
+enum class AuthMethod
+{
+    Ldap, // simple bind against the directory (LdapAuthenticator)
+    File, // user file with password hashes (FileAuthenticator)
+    Mock  // accepts everyone after a fixed delay, for benchmarks (MockAuthenticator)
+};
+
+struct AuthConfig
+{
+    AuthMethod method = AuthMethod::Ldap;
+    LdapPoolConfig ldap;
+    std::string user_file;                                          // File: one "username:crypt hash" per line
+    int mock_latency = 0;                                           // Mock: in ms until a login is accepted
+    int start_timeout = ServerConstants::LDAP_ACQUIRE_TIMEOUT;      // in sec, waiting for the backend to take a check
+    int check_timeout = ServerConstants::LDAP_OPERATION_TIMEOUT;    // in sec, one running check
+};
+
+enum class AuthStatus
+{
+    Pending,
+    Accepted,
+    Rejected, // the backend refused the credentials
+    Failed,   // no answer, e.g. backend error
+    Lost,     // the backend connection broke, worth one retry
+    Miss      // only AuthCache lookups: no cached answer, the backend has to check
+};
+
+// One credential check in flight. The server waits until descriptor() is
+// readable, or polls on a short timer if it is -1, and then calls poll().
+class AuthAttempt
+{
+public:
+    virtual ~AuthAttempt() = default;
+
+    virtual int descriptor() const = 0;
+
+    // Never blocks
+    virtual AuthStatus poll() = 0;
+
+    // The result is no longer wanted, called before a pending attempt is destroyed
+    virtual void abandon() {}
+};
+
+// Thread-safe, the worker threads share one authenticator. Forked handlers use
+// their own copy.
+class Authenticator
+{
+public:
+    virtual ~Authenticator() = default;
+
+    // Starts checking the credentials, nullptr while the backend is at capacity
+    // (e.g. every LDAP handle is busy); the caller tries again later.
+    virtual std::unique_ptr<AuthAttempt> try_start(const std::string &username, const std::string &password) = 0;
+
+    // Like try_start() but may wait for capacity, for forked handlers
+    virtual std::unique_ptr<AuthAttempt> start(const std::string &username, const std::string &password)
+    {
+        return try_start(username, password);
+    }
+};
+
+std::unique_ptr<Authenticator> create_authenticator(const AuthConfig &config);
+
+#endif // AUTHENTICATOR_H
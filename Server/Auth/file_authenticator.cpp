@@ -0,0 +1,56 @@
+#include "file_authenticator.h"
+#include "password_hash.h"
+#include <fstream>
+#include <stdexcept>
+#include "../../utils/log.h"
+
+namespace
+{
+class FinishedAttempt : public AuthAttempt
+{
+public:
+    explicit FinishedAttempt(AuthStatus status)
+    : status(status)
+    {}
+
+    int descriptor() const override { return -1; }
+    AuthStatus poll() override { return status; }
+
+private:
+    AuthStatus status;
+};
+}
+
+FileAuthenticator::FileAuthenticator(const std::string &path)
+{
+    std::ifstream user_file(path);
+    if (!user_file)
+    {
+        throw std::runtime_error("Unable to open user file " + path);
+    }
+
+    std::string line;
+    while (std::getline(user_file, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        size_t separator = line.find(':');
+        if (separator == std::string::npos || separator == 0)
+        {
+            LOG_WARNING("Skipping malformed line in user file " << path);
+            continue;
+        }
+        hashes[line.substr(0, separator)] = line.substr(separator + 1);
+    }
+    LOG_INFO("Loaded " << hashes.size() << " users from " << path);
+}
+
+std::unique_ptr<AuthAttempt> FileAuthenticator::try_start(const std::string &username, const std::string &password)
+{
+    auto user = hashes.find(username);
+    bool accepted = user != hashes.end() && verify_password(password, user->second.c_str());
+    LOG_DEBUG((accepted ? "Password accepted for user: " : "Password rejected for user: ") << username);
+    return std::unique_ptr<AuthAttempt>(new FinishedAttempt(accepted ? AuthStatus::Accepted : AuthStatus::Rejected));
+}
@@ -0,0 +1,81 @@
+#include "ldap_authenticator.h"
+#include "../../utils/log.h"
+
+namespace
+{
+// Holds the handle until the attempt is destroyed, the server stops watching
+// its socket before that
+class LdapAttempt : public AuthAttempt
+{
+public:
+    LdapAttempt(LdapPool::Lease lease, bool sent)
+    : ldap(std::move(lease))
+    , sent(sent)
+    {}
+
+    // a bind still waiting for its connection is polled on the timer, the
+    // socket only becomes readable once the request went out
+    int descriptor() const override
+    {
+        return sent && !ldap->bind_queued() ? ldap->descriptor() : -1;
+    }
+
+    AuthStatus poll() override
+    {
+        LDAP_Module::BindStatus status = sent ? ldap->poll_bind() : LDAP_Module::BindStatus::Failed;
+        switch (status)
+        {
+        case LDAP_Module::BindStatus::Pending:
+            return AuthStatus::Pending;
+        case LDAP_Module::BindStatus::Success:
+            return AuthStatus::Accepted;
+        case LDAP_Module::BindStatus::Rejected:
+            return AuthStatus::Rejected;
+        case LDAP_Module::BindStatus::Failed:
+        default:
+            // a pooled connection may have died while idle, that says nothing about the password
+            return ldap->healthy() ? AuthStatus::Failed : AuthStatus::Lost;
+        }
+    }
+
+    void abandon() override
+    {
+        ldap->abandon_bind();
+    }
+
+private:
+    LdapPool::Lease ldap;
+    bool sent;
+};
+}
+
+LdapAuthenticator::LdapAuthenticator(const LdapPoolConfig &config)
+: pool(config)
+{}
+
+std::unique_ptr<AuthAttempt> LdapAuthenticator::try_start(const std::string &username, const std::string &password)
+{
+    LdapPool::Lease lease = pool.try_acquire();
+    return lease ? bind(std::move(lease), username, password) : nullptr;
+}
+
+std::unique_ptr<AuthAttempt> LdapAuthenticator::start(const std::string &username, const std::string &password)
+{
+    LdapPool::Lease lease = pool.acquire();
+    return lease ? bind(std::move(lease), username, password) : nullptr;
+}
+
+std::unique_ptr<AuthAttempt> LdapAuthenticator::bind(LdapPool::Lease lease, const std::string &username, const std::string &password)
+{
+    bool sent = false;
+    // try catch block to catch any LDAP related errors
+    try
+    {
+        sent = lease->start_bind(username, password) && lease->descriptor() >= 0;
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR(e.what());
+    }
+    return std::unique_ptr<AuthAttempt>(new LdapAttempt(std::move(lease), sent));
+}
@@ -0,0 +1,22 @@
+#ifndef LDAP_AUTHENTICATOR_H
+#define LDAP_AUTHENTICATOR_H
+
+#include "authenticator.h"
+
+// Simple bind as uid=<username>,<base DN> on a pooled handle, sent without
+// waiting; the answer arrives on the handle's socket.
+class LdapAuthenticator : public Authenticator
+{
+public:
+    explicit LdapAuthenticator(const LdapPoolConfig &config);
+
+    std::unique_ptr<AuthAttempt> try_start(const std::string &username, const std::string &password) override;
+    std::unique_ptr<AuthAttempt> start(const std::string &username, const std::string &password) override;
+
+private:
+    LdapPool pool;
+
+    std::unique_ptr<AuthAttempt> bind(LdapPool::Lease lease, const std::string &username, const std::string &password);
+};
+
+#endif // LDAP_AUTHENTICATOR_H
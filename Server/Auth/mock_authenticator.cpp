@@ -0,0 +1,69 @@
+#include "mock_authenticator.h"
+#include <cerrno>
+#include <cstdint>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "../../utils/log.h"
+
+namespace
+{
+class DelayedAttempt : public AuthAttempt
+{
+public:
+    explicit DelayedAttempt(int latency)
+    {
+        if (latency <= 0)
+        {
+            return;
+        }
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct itimerspec delay = {};
+        delay.it_value.tv_sec = latency / 1000;
+        delay.it_value.tv_nsec = (latency % 1000) * 1000000L;
+        if (timer_fd == -1 || timerfd_settime(timer_fd, 0, &delay, nullptr) == -1)
+        {
+            LOG_ERROR("Unable to arm the mock login timer: " << errno);
+            failed = true;
+        }
+    }
+
+    ~DelayedAttempt() override
+    {
+        if (timer_fd != -1)
+        {
+            close(timer_fd);
+        }
+    }
+
+    int descriptor() const override { return timer_fd; }
+
+    AuthStatus poll() override
+    {
+        if (failed)
+        {
+            return AuthStatus::Failed;
+        }
+        if (timer_fd == -1)
+        {
+            return AuthStatus::Accepted;
+        }
+        uint64_t expirations;
+        return read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations) ? AuthStatus::Accepted : AuthStatus::Pending;
+    }
+
+private:
+    int timer_fd = -1;
+    bool failed = false;
+};
+}
+
+MockAuthenticator::MockAuthenticator(int latency)
+: latency(latency)
+{
+    LOG_INFO("Mock authentication: every login is accepted after " << latency << " ms");
+}
+
+std::unique_ptr<AuthAttempt> MockAuthenticator::try_start(const std::string &username, const std::string &password)
+{
+    return std::unique_ptr<AuthAttempt>(new DelayedAttempt(latency));
+}
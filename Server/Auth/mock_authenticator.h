@@ -0,0 +1,19 @@
+#ifndef MOCK_AUTHENTICATOR_H
+#define MOCK_AUTHENTICATOR_H
+
+#include "authenticator.h"
+
+// Accepts every login after latency ms, standing in for the directory in
+// benchmarks. The delay is a timerfd, so waiting logins cost no thread.
+class MockAuthenticator : public Authenticator
+{
+public:
+    explicit MockAuthenticator(int latency);
+
+    std::unique_ptr<AuthAttempt> try_start(const std::string &username, const std::string &password) override;
+
+private:
+    int latency; // in ms
+};
+
+#endif // MOCK_AUTHENTICATOR_H
@@ -0,0 +1,40 @@
+#include "password_hash.h"
+#include <crypt.h>
+#include <cstring>
+#include <sys/random.h>
+#include "../../utils/constants.h"
+
+// crypt_r keeps its (large) work area in the caller's crypt_data
+static const char *run_crypt(const std::string &password, const char *setting)
+{
+    static thread_local struct crypt_data data;
+    const char *hashed = crypt_r(password.c_str(), setting, &data);
+    // failures come back as null or as a string starting with '*'
+    return (hashed == nullptr || hashed[0] == '*') ? nullptr : hashed;
+}
+
+std::string hash_password(const std::string &password)
+{
+    static constexpr char ALPHABET[] = "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    unsigned char random[16];
+    if (getrandom(random, sizeof(random), 0) != sizeof(random))
+    {
+        return std::string();
+    }
+
+    // "$6$rounds=N$" + 16 random salt characters
+    std::string setting = "$6$rounds=" + std::to_string(ServerConstants::AUTH_CACHE_HASH_ROUNDS) + "$";
+    for (unsigned char byte : random)
+    {
+        setting += ALPHABET[byte % 64];
+    }
+
+    const char *hashed = run_crypt(password, setting.c_str());
+    return hashed != nullptr ? std::string(hashed) : std::string();
+}
+
+bool verify_password(const std::string &password, const char *hash)
+{
+    const char *hashed = run_crypt(password, hash);
+    return hashed != nullptr && std::strcmp(hashed, hash) == 0;
+}
@@ -0,0 +1,14 @@
+#ifndef PASSWORD_HASH_H
+#define PASSWORD_HASH_H
+
+#include <string>
+
+// crypt(3) password hashes, as written by e.g. "openssl passwd -6"
+
+// Salted SHA-512 crypt hash of password, empty on error
+std::string hash_password(const std::string &password);
+
+// True if password hashes to hash, which carries its own method, rounds and salt
+bool verify_password(const std::string &password, const char *hash);
+
+#endif // PASSWORD_HASH_H
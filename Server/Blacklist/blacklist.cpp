@@ -1,134 +1,341 @@
 #include "blacklist.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
 #include <fstream>
 #include <sstream>
-#include <iostream>
+#include <new>
+#include <stdexcept>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <string>
 #include <cstring>
 #include <unistd.h>
-#include <ctime>
+#include <vector>
 #include "../../utils/constants.h"
+#include "../../utils/log.h"
 
-Blacklist::Blacklist()
+static bool parse_ip(const std::string &ip, uint32_t &key)
 {
-    std::ofstream blacklist_file(path, std::ios::app);
-    if (!blacklist_file) {
-        std::cout << "Error creating or accessing the blacklist file at " << path << std::endl;
-    } else {
-        std::cout << "Blacklist file ensured at " << path << std::endl;
+    struct in_addr address;
+    if (inet_pton(AF_INET, ip.c_str(), &address) != 1 || address.s_addr == 0)
+    {
+        return false;
     }
+    key = address.s_addr;
+    return true;
 }
 
-void Blacklist::add(const std::string &ip, sem_t *blacklist_sem)
+Blacklist::Blacklist()
 {
-    sem_wait(blacklist_sem);
-
-    std::ofstream blacklist_file(path, std::ios::app); // Open file in append mode
-    if (!blacklist_file)
+    // shared before the first fork, so every handler sees the same table
+    void *memory = mmap(nullptr, sizeof(Table), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
     {
-        std::cout << "Failed to open blacklist file for writing." << std::endl;
-        sem_post(blacklist_sem);
+        throw std::runtime_error("Unable to map the blacklist: " + std::to_string(errno));
+    }
+    table = new (memory) Table(); // zeroed: every slot is EMPTY
 
-        return;
+    if (sem_init(&table->write_lock, 1, 1) != 0)
+    {
+        munmap(memory, sizeof(Table));
+        throw std::runtime_error("Semaphore initialization failed for the blacklist");
     }
+}
 
-    time_t curr_time = std::time(nullptr);                 // Get current timestamp
-    blacklist_file << ip << "," << curr_time << std::endl; // Write the IP and timestamp
-    sem_post(blacklist_sem);
-    std::cout << "IP added to blacklist: " << ip << " at " << curr_time << std::endl;
+Blacklist::~Blacklist()
+{
+    munmap(table, sizeof(Table));
 }
 
-bool Blacklist::is_blacklisted(const std::string &ip, sem_t *blacklist_sem)
+size_t Blacklist::home_slot(uint32_t ip)
 {
-    // Lock the semaphore
-    sem_wait(blacklist_sem);
+    // Fibonacci hashing, the low bits of neighbouring addresses differ little
+    return ((static_cast<uint64_t>(ip) * 11400714819323198485ULL) >> 32) & (CAPACITY - 1);
+}
 
-    std::ifstream blacklist_file(path);
-    if (!blacklist_file)
+bool Blacklist::expired(int64_t added, time_t now)
+{
+    return difftime(now, added) > ServerConstants::BLACKLIST_TIMEOUT;
+}
+
+// Slot of ip, CAPACITY if it is not in the table. Readers call this between two
+// reads of the sequence counter, so it only uses relaxed atomic loads.
+size_t Blacklist::find_slot(uint32_t ip) const
+{
+    size_t index = home_slot(ip);
+    for (size_t probes = 0; probes < CAPACITY; probes++)
+    {
+        uint32_t stored = table->slots[index].ip.load(std::memory_order_relaxed);
+        if (stored == EMPTY)
+        {
+            return CAPACITY;
+        }
+        if (stored == ip)
+        {
+            return index;
+        }
+        index = (index + 1) & (CAPACITY - 1);
+    }
+    return CAPACITY;
+}
+
+// Timestamp of ip, -1 if it is not in the table
+int64_t Blacklist::find(uint32_t ip) const
+{
+    size_t index = find_slot(ip);
+    return index < CAPACITY ? table->slots[index].added.load(std::memory_order_relaxed) : -1;
+}
+
+bool Blacklist::is_blacklisted(const std::string &ip) const
+{
+    uint32_t key;
+    if (!parse_ip(ip, key))
     {
-        std::cout << "Failed to open blacklist file for reading." << std::endl;
-        // Unlock semaphore before returning
-        sem_post(blacklist_sem);
         return false;
     }
 
-    std::string line;
+    while (true)
+    {
+        uint32_t before = table->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            continue; // a writer is busy, writes are rare and short
+        }
+        int64_t added = find(key);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (table->sequence.load(std::memory_order_relaxed) == before)
+        {
+            return added >= 0 && !expired(added, std::time(nullptr));
+        }
+    }
+}
+
+void Blacklist::add(const std::string &ip)
+{
+    uint32_t key;
+    if (!parse_ip(ip, key))
+    {
+        LOG_WARNING("Unable to blacklist invalid IP " << ip);
+        return;
+    }
+
     time_t curr_time = std::time(nullptr); // Get current timestamp
-    bool blacklisted = false;
+    begin_write();
+    insert(key, curr_time);
+    end_write();
+    LOG_DEBUG("IP added to blacklist: " << ip << " at " << curr_time);
+}
 
-    while (std::getline(blacklist_file, line))
+// Caller holds the write lock. Timestamps must not decrease from call to call,
+// the expiry FIFO relies on it.
+void Blacklist::insert(uint32_t ip, int64_t added)
+{
+    // a full FIFO forgets its oldest add, that slot is then only reused by a later insert
+    if (table->expiry_count == CAPACITY)
     {
-        std::istringstream line_stream(line);
-        std::string stored_ip;
-        std::string timestamp_str;
+        table->expiry_head = (table->expiry_head + 1) % CAPACITY;
+        table->expiry_count--;
+    }
+    table->expiries[(table->expiry_head + table->expiry_count) % CAPACITY] = Expiry{ip, added};
+    table->expiry_count++;
 
-        if (std::getline(line_stream, stored_ip, ',') && std::getline(line_stream, timestamp_str))
+    // the first expired slot on the way is reused, but only once the whole
+    // probe sequence is known not to contain ip already
+    time_t now = std::time(nullptr);
+    Slot *reusable = nullptr;
+    size_t index = home_slot(ip);
+    for (size_t probes = 0; probes < CAPACITY; probes++)
+    {
+        Slot &slot = table->slots[index];
+        uint32_t stored = slot.ip.load(std::memory_order_relaxed);
+        if (stored == ip)
         {
-            // Convert the timestamp to time_t
-            time_t timestamp = std::stoll(timestamp_str);
-
-            // If the IP matches and the timestamp is within 60 seconds
-            if (stored_ip == ip && difftime(curr_time, timestamp) <= ServerConstants::BLACKLIST_TIMEOUT)
+            slot.added.store(added, std::memory_order_relaxed);
+            return;
+        }
+        if (stored == EMPTY)
+        {
+            if (reusable == nullptr)
             {
-                blacklisted = true;
-                break;
+                reusable = &slot;
             }
+            break;
         }
+        if (reusable == nullptr && expired(slot.added.load(std::memory_order_relaxed), now))
+        {
+            reusable = &slot;
+        }
+        index = (index + 1) & (CAPACITY - 1);
     }
 
-    // Unlock the semaphore before returning
-    sem_post(blacklist_sem);
+    if (reusable == nullptr)
+    {
+        LOG_WARNING("Blacklist is full, entry dropped");
+        return;
+    }
+    reusable->ip.store(ip, std::memory_order_relaxed);
+    reusable->added.store(added, std::memory_order_relaxed);
+}
+
+// Empties the slot and moves later entries of the probe sequence back, so no
+// lookup stops early at the new gap (backward shift deletion). Caller holds the write lock.
+void Blacklist::erase(size_t index)
+{
+    size_t next = index;
+    while (true)
+    {
+        next = (next + 1) & (CAPACITY - 1);
+        uint32_t stored = table->slots[next].ip.load(std::memory_order_relaxed);
+        if (stored == EMPTY)
+        {
+            break;
+        }
 
-    return blacklisted;
+        // an entry whose home lies cyclically in (index, next] is still reachable
+        size_t home = home_slot(stored);
+        bool reachable = index <= next ? (index < home && home <= next) : (index < home || home <= next);
+        if (reachable)
+        {
+            continue;
+        }
+        table->slots[index].ip.store(stored, std::memory_order_relaxed);
+        table->slots[index].added.store(table->slots[next].added.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        index = next;
+    }
+    table->slots[index].ip.store(EMPTY, std::memory_order_relaxed);
+    table->slots[index].added.store(0, std::memory_order_relaxed);
 }
 
-void Blacklist::cleanUp(sem_t *blacklist_sem)
+void Blacklist::cleanUp()
 {
-    sem_wait(blacklist_sem);
+    time_t curr_time = std::time(nullptr); // Get current timestamp
+    int removed = 0;
 
+    begin_write();
+    while (table->expiry_count > 0)
+    {
+        const Expiry &oldest = table->expiries[table->expiry_head];
+        if (!expired(oldest.added, curr_time))
+        {
+            break; // everything behind it is younger
+        }
+
+        size_t index = find_slot(oldest.ip);
+        if (index < CAPACITY && table->slots[index].added.load(std::memory_order_relaxed) == oldest.added)
+        {
+            erase(index);
+            removed++;
+        }
+        table->expiry_head = (table->expiry_head + 1) % CAPACITY;
+        table->expiry_count--;
+    }
+    end_write();
+
+    if (removed > 0)
+    {
+        LOG_DEBUG("Blacklist cleaned up, " << removed << " entries expired.");
+    }
+}
+
+void Blacklist::load_snapshot()
+{
     std::ifstream blacklist_file(path);
     if (!blacklist_file)
     {
-        std::cout << "Failed to open blacklist file for reading." << std::endl;
-        sem_post(blacklist_sem);
-        return;
+        return; // nothing persisted yet
     }
 
-    std::stringstream valid_entries;
     std::string line;
     time_t curr_time = std::time(nullptr); // Get current timestamp
-
-    // Read through the blacklist and filter out expired entries
+    std::vector<Expiry> entries;
     while (std::getline(blacklist_file, line))
     {
         std::istringstream line_stream(line);
         std::string stored_ip;
         std::string timestamp_str;
+        uint32_t key;
 
-        if (std::getline(line_stream, stored_ip, ',') && std::getline(line_stream, timestamp_str))
+        if (std::getline(line_stream, stored_ip, ',') && std::getline(line_stream, timestamp_str) && parse_ip(stored_ip, key))
         {
-            time_t timestamp = std::stoll(timestamp_str);
+            time_t timestamp = std::atoll(timestamp_str.c_str());
+            if (!expired(timestamp, curr_time))
+            {
+                entries.push_back(Expiry{key, timestamp});
+            }
+        }
+    }
+
+    // oldest first, as insert() expects
+    std::sort(entries.begin(), entries.end(), [](const Expiry &a, const Expiry &b) { return a.added < b.added; });
+    begin_write();
+    for (const auto &entry : entries)
+    {
+        insert(entry.ip, entry.added);
+    }
+    end_write();
+}
 
-            // Keep only those entries that are not older than BLACKLIST_TIMEOUT
-            if (difftime(curr_time, timestamp) <= ServerConstants::BLACKLIST_TIMEOUT)
+void Blacklist::save_snapshot() const
+{
+    // lock-free copy of the valid entries, retried if a writer interfered
+    std::vector<std::pair<uint32_t, int64_t>> entries;
+    time_t curr_time = std::time(nullptr); // Get current timestamp
+    while (true)
+    {
+        uint32_t before = table->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            continue;
+        }
+        entries.clear();
+        for (const Slot &slot : table->slots)
+        {
+            uint32_t stored = slot.ip.load(std::memory_order_relaxed);
+            int64_t added = slot.added.load(std::memory_order_relaxed);
+            if (stored != EMPTY && !expired(added, curr_time))
             {
-                valid_entries << stored_ip << "," << timestamp_str << std::endl;
+                entries.emplace_back(stored, added);
             }
         }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (table->sequence.load(std::memory_order_relaxed) == before)
+        {
+            break;
+        }
     }
 
-    // Open file and only print valid entries in file
-    std::ofstream blacklist_file_out(path, std::ios::trunc);
-    if (!blacklist_file_out)
+    std::string temp_path = path + ".tmp";
+    std::ofstream blacklist_file_out(temp_path, std::ios::trunc);
+    for (const auto &entry : entries)
     {
-        std::cout << "Failed to open blacklist file for cleaning." << std::endl;
-        sem_post(blacklist_sem);
-        return;
+        char ip[INET_ADDRSTRLEN];
+        struct in_addr address;
+        address.s_addr = entry.first;
+        blacklist_file_out << inet_ntop(AF_INET, &address, ip, sizeof(ip)) << "," << entry.second << "\n";
     }
+    blacklist_file_out.close();
 
-    blacklist_file_out << valid_entries.str();
+    if (!blacklist_file_out || std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        LOG_ERROR("Failed to write blacklist snapshot.");
+        unlink(temp_path.c_str());
+    }
+}
 
-    sem_post(blacklist_sem);
-    std::cout << "Blacklist cleaned up." << std::endl;
+void Blacklist::begin_write()
+{
+    while (sem_wait(&table->write_lock) != 0 && errno == EINTR)
+    {
+    }
+    uint32_t sequence = table->sequence.load(std::memory_order_relaxed);
+    table->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void Blacklist::end_write()
+{
+    table->sequence.store(table->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    sem_post(&table->write_lock);
 }
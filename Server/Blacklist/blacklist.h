@@ -1,27 +1,90 @@
 #ifndef BLACKLIST_H
 #define BLACKLIST_H
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
 #include <string>
 #include <semaphore.h>
 
+// IPs that failed to log in too often, blocked for BLACKLIST_TIMEOUT seconds.
+//
+// A fixed-size open-addressing (linear probing) table keyed by IPv4 address in
+// anonymous shared memory, created before the server forks. Lookups take no lock:
+// a sequence counter (seqlock) tells them to retry if a writer changed the table
+// meanwhile. Writers serialize on a process-shared semaphore.
+//
+// Entries expire by their timestamp, lookups simply ignore old ones. Their
+// slots are freed by cleanUp(), which the server runs from a background thread:
+// every entry has the same lifetime, so a FIFO of the adds is also the order of
+// expiry and a cleanup only visits the entries that expired. The table is only
+// persisted if snapshots are enabled, in the "ip,timestamp" format of the
+// former blacklist.txt.
 class Blacklist {
 public:
-    // Constructor and Destructor
     Blacklist();
-    ~Blacklist() = default;
+    ~Blacklist();
 
-    // Check if an IP is blacklisted
-    bool is_blacklisted(const std::string& ip, sem_t* blacklist_sem);
+    Blacklist(const Blacklist&) = delete;
+    Blacklist& operator=(const Blacklist&) = delete;
+
+    // Check if an IP is blacklisted, never blocks
+    bool is_blacklisted(const std::string& ip) const;
 
     // Add an IP to the blacklist with the current timestamp
-    void add(const std::string& ip, sem_t* blacklist_sem);
+    void add(const std::string& ip);
+
+    // Frees the slots of expired entries, cost proportional to their number
+    void cleanUp();
+
+    // Reads entries that are still valid from the snapshot file, if there is one
+    void load_snapshot();
 
-    // Clean up expired blacklist entries
-    void cleanUp(sem_t* blacklist_sem);
+    // Writes the valid entries to the snapshot file (temp file + rename)
+    void save_snapshot() const;
 
 private:
+    static constexpr size_t CAPACITY = 4096; // power of two
+    static constexpr uint32_t EMPTY = 0;     // 0.0.0.0 never connects
+
+    struct Slot
+    {
+        std::atomic<uint32_t> ip;
+        std::atomic<int64_t> added; // time() of the add
+    };
+
+    // An add in the expiry FIFO. Stale once the IP was added again or its slot reused
+    struct Expiry
+    {
+        uint32_t ip;
+        int64_t added;
+    };
+
+    struct Table
+    {
+        sem_t write_lock;
+        std::atomic<uint32_t> sequence; // odd while a writer is changing slots
+        Slot slots[CAPACITY];
+
+        // written under write_lock only, lookups never read it
+        Expiry expiries[CAPACITY];
+        size_t expiry_head;
+        size_t expiry_count;
+    };
+
     const std::string path="Server/Blacklist/blacklist.txt";
-    // Private helper functions or member variables can be added here if needed.
+    Table* table = nullptr;
+
+    static size_t home_slot(uint32_t ip);
+    static bool expired(int64_t added, time_t now);
+
+    size_t find_slot(uint32_t ip) const;
+    int64_t find(uint32_t ip) const;
+    void insert(uint32_t ip, int64_t added);
+    void erase(size_t index);
+    void begin_write();
+    void end_write();
 };
 
 #endif // BLACKLIST_H
@@ -1,11 +1,15 @@
 #include "ldap_module.h"
+#include <poll.h>
+#include <sys/time.h>
 #include "../../utils/constants.h"
+#include "../../utils/log.h"
 
-LDAP_Module::LDAP_Module(const std::string &ldap_url)
+LDAP_Module::LDAP_Module(const std::string &ldap_url, const std::string &base_dn, int network_timeout, int operation_timeout)
 : ldap_url(ldap_url)
+, base_dn(base_dn)
 , ldap_obj(nullptr)
 {
-    init_ldap();
+    init_ldap(network_timeout, operation_timeout);
 }
 
 LDAP_Module::~LDAP_Module()
@@ -14,56 +18,184 @@ LDAP_Module::~LDAP_Module()
 }
 
 // Initialize LDAP object
-void LDAP_Module::init_ldap()
+void LDAP_Module::init_ldap(int network_timeout, int operation_timeout)
 {
     int result = ldap_initialize(&ldap_obj, ldap_url.c_str());
     if (result != LDAP_SUCCESS)
     {
-        std::cout << "LDAP initialization failed: " << ldap_err2string(result) << std::endl;
+        LOG_ERROR("LDAP initialization failed: " << ldap_err2string(result));
         throw std::runtime_error("Error initializing LDAP");
     }
 
     result = ldap_set_option(ldap_obj, LDAP_OPT_PROTOCOL_VERSION, &ServerConstants::DESIRED_LDAP_VERSION);
     if (result != LDAP_SUCCESS)
     {
-        std::cout << "Failed to set LDAP version: " << ldap_err2string(result) << std::endl;
+        LOG_ERROR("Failed to set LDAP version: " << ldap_err2string(result));
         cleanup();
         throw std::runtime_error("Error setting LDAP version");
     }
 
-    std::cout << "LDAP initialized and set to version 3\n";
+    // an unreachable directory must not hang a login forever
+    struct timeval connect_timeout = {network_timeout, 0};
+    struct timeval bind_timeout = {operation_timeout, 0};
+    if (ldap_set_option(ldap_obj, LDAP_OPT_NETWORK_TIMEOUT, &connect_timeout) != LDAP_OPT_SUCCESS ||
+        ldap_set_option(ldap_obj, LDAP_OPT_TIMEOUT, &bind_timeout) != LDAP_OPT_SUCCESS)
+    {
+        LOG_ERROR("Failed to set LDAP timeouts");
+        cleanup();
+        throw std::runtime_error("Error setting LDAP timeouts");
+    }
+
+    // a slow or unreachable directory must not block the reactor thread in connect()
+    if (ldap_set_option(ldap_obj, LDAP_OPT_CONNECT_ASYNC, LDAP_OPT_ON) != LDAP_OPT_SUCCESS)
+    {
+        LOG_ERROR("Failed to enable asynchronous LDAP connects");
+        cleanup();
+        throw std::runtime_error("Error setting LDAP connect mode");
+    }
+
+    LOG_DEBUG("LDAP initialized and set to version 3");
 }
 
-bool LDAP_Module::authenticate(const std::string &username, const std::string &password)
+bool LDAP_Module::start_bind(const std::string &username, const std::string &password)
 {
-
-    std::string dn = "uid=" + username + ",ou=People,dc=technikum-wien,dc=at";
+    std::string dn = "uid=" + username + "," + base_dn;
     // cast password to LDAP-compatible BER-type
     BerValue cred;
     cred.bv_val = const_cast<char *>(password.c_str()); // const_cast to remove (const) bc ber-type expects non-const
     cred.bv_len = password.length();
 
-    // Perform SASL bind using SIMPLE mechanism
-    int result = ldap_sasl_bind_s(
+    // Send SASL bind using SIMPLE mechanism, the answer is collected by poll_bind().
+    // A handle that is not connected yet only starts connecting here, the library
+    // keeps the request until the socket is writable.
+    int result = ldap_sasl_bind(
         ldap_obj,   // LDAP session handle
         dn.c_str(), // Distinguished Name (DN)
         nullptr,    // Mechanism ("SIMPLE" uses nullptr)
         &cred,      // Pointer to credentials (BerValue)
         nullptr,    // Server controls (nullptr for none)
         nullptr,    // client_addr controls (nullptr for none)
-        nullptr     // Pointer for result server credentials (not needed here)
+        &bind_msgid // Message id of the request, to match the answer
     );
 
+    if (result != LDAP_SUCCESS)
+    {
+        // the request could not even be sent: server down, connect timeout, ...
+        connection_lost = true;
+        bind_msgid = -1;
+        LOG_WARNING("LDAP SASL bind failed: " << ldap_err2string(result));
+        return false;
+    }
+    bind_user = username;
+
+    // still connecting: the socket is not writable yet
+    struct pollfd poll_fd = {descriptor(), POLLOUT, 0};
+    connecting = poll_fd.fd >= 0 && poll(&poll_fd, 1, 0) == 0;
+    return true;
+}
+
+LDAP_Module::BindStatus LDAP_Module::poll_bind()
+{
+    if (bind_msgid < 0)
+    {
+        return BindStatus::Failed;
+    }
+
+    // once the connect finished (or failed) the call below sends the queued request
+    bool connected = false;
+    if (connecting)
+    {
+        struct pollfd poll_fd = {descriptor(), POLLOUT, 0};
+        connected = poll(&poll_fd, 1, 0) != 0;
+    }
+
+    struct timeval no_wait = {0, 0};
+    LDAPMessage *answer = nullptr;
+    int type = ldap_result(ldap_obj, bind_msgid, LDAP_MSG_ALL, &no_wait, &answer);
+    if (connected)
+    {
+        connecting = false;
+    }
+    if (type == 0)
+    {
+        return BindStatus::Pending;
+    }
+    bind_msgid = -1;
+    connecting = false;
+    if (type == -1 || answer == nullptr)
+    {
+        connection_lost = true;
+        LOG_WARNING("LDAP SASL bind failed: connection to the directory lost");
+        return BindStatus::Failed;
+    }
+
+    int result = LDAP_SUCCESS;
+    int parsed = ldap_parse_result(ldap_obj, answer, &result, nullptr, nullptr, nullptr, nullptr, 1); // frees answer
+    if (parsed != LDAP_SUCCESS)
+    {
+        result = parsed;
+    }
+
     if (result == LDAP_SUCCESS)
     {
-        std::cout << "LDAP SASL bind successful for user: " << username << std::endl;
-        return true;
+        LOG_DEBUG("LDAP SASL bind successful for user: " << bind_user);
+        return BindStatus::Success;
+    }
+    if (result == LDAP_INVALID_CREDENTIALS)
+    {
+        LOG_WARNING("LDAP SASL bind failed: " << ldap_err2string(result));
+        return BindStatus::Rejected;
     }
-    else
+
+    // negative codes come from the client library (server down, timeout, ...),
+    // positive ones are answers of the directory such as invalid credentials
+    if (result < 0)
+    {
+        connection_lost = true;
+    }
+    LOG_WARNING("LDAP SASL bind failed: " << ldap_err2string(result));
+    return BindStatus::Failed;
+}
+
+void LDAP_Module::abandon_bind()
+{
+    if (bind_msgid >= 0)
+    {
+        ldap_abandon_ext(ldap_obj, bind_msgid, nullptr, nullptr);
+        bind_msgid = -1;
+    }
+    connecting = false;
+    // a late answer could still arrive on this connection, the next user must not see it
+    connection_lost = true;
+}
+
+int LDAP_Module::descriptor() const
+{
+    int fd = -1;
+    if (ldap_get_option(ldap_obj, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS)
+    {
+        return -1;
+    }
+    return fd;
+}
+
+bool LDAP_Module::healthy() const
+{
+    if (connection_lost)
     {
-        std::cout << "LDAP SASL bind failed: " << ldap_err2string(result) << std::endl;
         return false;
     }
+
+    int fd = descriptor();
+    if (fd < 0)
+    {
+        return true; // not connected yet, the next bind connects
+    }
+
+    // an idle connection has nothing to read. Readable means the directory
+    // closed it or sent a notice of disconnection, e.g. after its idle timeout
+    struct pollfd poll_fd = {fd, POLLIN | POLLRDHUP, 0};
+    return poll(&poll_fd, 1, 0) == 0;
 }
 
 void LDAP_Module::cleanup()
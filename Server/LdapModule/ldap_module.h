@@ -9,17 +9,52 @@
 
 class LDAP_Module {
 public:
-    LDAP_Module(const std::string& ldap_url);
+    // users are bound as uid=<username>,<base_dn>
+    // timeouts in seconds: network_timeout for connecting, operation_timeout for a bind.
+    // Connections are opened without blocking, a bind on an unconnected handle
+    // only starts connecting; the caller's own deadline bounds the wait then.
+    LDAP_Module(const std::string& ldap_url, const std::string& base_dn, int network_timeout, int operation_timeout);
     ~LDAP_Module();
 
-    bool authenticate(const std::string& username, const std::string& password);
+    LDAP_Module(const LDAP_Module&) = delete;
+    LDAP_Module& operator=(const LDAP_Module&) = delete;
+
+    // Rejected: the directory refused the credentials, Failed: any other error
+    enum class BindStatus { Pending, Success, Rejected, Failed };
+
+    // Sends a simple bind as username without waiting for the answer. A handle
+    // can authenticate any number of users in turn, one bind at a time.
+    bool start_bind(const std::string& username, const std::string& password);
+
+    // True while the bind waits for the connection to the directory. It goes
+    // out with the first poll_bind() once the connection is up; until then the
+    // descriptor does not become readable, so poll_bind() has to run on a timer.
+    bool bind_queued() const { return connecting; }
+
+    // Collects the answer to the bind started last, never blocks
+    BindStatus poll_bind();
+
+    // Gives up on the running bind, the handle is not reused afterwards
+    void abandon_bind();
+
+    // Socket to the directory for poll/epoll, readable once the answer arrived.
+    // -1 before the first bind started connecting the handle.
+    int descriptor() const;
+
+    // False once the connection to the directory is known to be gone
+    bool healthy() const;
 
 private:
     std::string ldap_url;
+    std::string base_dn;
     LDAP* ldap_obj;
+    bool connection_lost = false;
+    bool connecting = false; // see bind_queued()
+    int bind_msgid = -1;
+    std::string bind_user;
     
-    void init_ldap();
+    void init_ldap(int network_timeout, int operation_timeout);
     void cleanup();
 };
 
-#endif // LDAP_MODULE_H
\ No newline at end of file
+#endif // LDAP_MODULE_H
@@ -0,0 +1,119 @@
+#include "ldap_pool.h"
+#include "../../utils/log.h"
+
+LdapPool::Lease::Lease(LdapPool *pool, std::unique_ptr<LDAP_Module> handle)
+: pool(pool)
+, handle(std::move(handle))
+{}
+
+LdapPool::Lease &LdapPool::Lease::operator=(Lease &&other)
+{
+    if (this != &other)
+    {
+        release();
+        pool = other.pool;
+        handle = std::move(other.handle);
+    }
+    return *this;
+}
+
+LdapPool::Lease::~Lease()
+{
+    release();
+}
+
+void LdapPool::Lease::release()
+{
+    if (pool != nullptr && handle != nullptr)
+    {
+        pool->give_back(std::move(handle));
+    }
+}
+
+LdapPool::LdapPool(const LdapPoolConfig &config)
+: config(config)
+{}
+
+std::unique_ptr<LDAP_Module> LdapPool::create_handle()
+{
+    try
+    {
+        return std::unique_ptr<LDAP_Module>(new LDAP_Module(config.url, config.base_dn, config.network_timeout, config.operation_timeout));
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("Unable to create LDAP handle: " << e.what());
+        std::lock_guard<std::mutex> lock(mutex);
+        created--;
+        available.notify_one();
+        return nullptr;
+    }
+}
+
+LdapPool::Lease LdapPool::acquire()
+{
+    Lease lease = acquire_until(std::chrono::steady_clock::now() + std::chrono::seconds(config.acquire_timeout));
+    if (!lease)
+    {
+        LOG_WARNING("No LDAP handle became free within " << config.acquire_timeout << " sec");
+    }
+    return lease;
+}
+
+LdapPool::Lease LdapPool::try_acquire()
+{
+    return acquire_until(std::chrono::steady_clock::now());
+}
+
+LdapPool::Lease LdapPool::acquire_until(std::chrono::steady_clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        if (!available.wait_until(lock, deadline, [this]() { return !idle.empty() || created < config.size; }))
+        {
+            return Lease();
+        }
+
+        if (idle.empty())
+        {
+            // below the limit: open another one, outside the lock
+            created++;
+            lock.unlock();
+            std::unique_ptr<LDAP_Module> handle = create_handle();
+            return handle ? Lease(this, std::move(handle)) : Lease();
+        }
+
+        IdleHandle candidate = std::move(idle.back());
+        idle.pop_back();
+
+        // the directory drops idle connections on its own schedule, so both age and socket state are checked
+        auto idle_for = std::chrono::steady_clock::now() - candidate.since;
+        if (idle_for < std::chrono::seconds(config.max_idle) && candidate.handle->healthy())
+        {
+            return Lease(this, std::move(candidate.handle));
+        }
+
+        lock.unlock();
+        candidate.handle.reset(); // unbind outside the lock
+        lock.lock();
+        created--;
+    }
+}
+
+void LdapPool::give_back(std::unique_ptr<LDAP_Module> handle)
+{
+    if (!handle->healthy())
+    {
+        handle.reset();
+        std::lock_guard<std::mutex> lock(mutex);
+        created--;
+        available.notify_one();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.push_back(IdleHandle{std::move(handle), std::chrono::steady_clock::now()});
+    available.notify_one();
+}
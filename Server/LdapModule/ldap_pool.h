@@ -0,0 +1,83 @@
+#ifndef LDAP_POOL_H
+#define LDAP_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ldap_module.h"
+#include "../../utils/constants.h"
+
+struct LdapPoolConfig
+{
+    std::string url = ServerConstants::HOST_URL;
+    std::string base_dn = ServerConstants::LDAP_BASE_DN;                 // parent entry of the user entries
+    size_t size = ServerConstants::LDAP_POOL_SIZE;                       // handles alive at most, idle + leased
+    int network_timeout = ServerConstants::LDAP_NETWORK_TIMEOUT;         // in sec, connecting to the directory
+    int operation_timeout = ServerConstants::LDAP_OPERATION_TIMEOUT;     // in sec, one bind
+    int acquire_timeout = ServerConstants::LDAP_ACQUIRE_TIMEOUT;         // in sec, waiting for a free handle
+    int max_idle = ServerConstants::LDAP_MAX_IDLE;                       // in sec, older idle handles are replaced
+};
+
+// Bounded pool of initialized LDAP handles, reused across logins so a login
+// costs one bind instead of initialize + connect + bind + unbind.
+//
+// Thread-safe, the worker threads share one pool. Handles are created lazily:
+// forked handlers start with an empty copy and reuse their handles for the
+// logins of their own connection, a connection to the directory is never
+// shared between processes.
+class LdapPool
+{
+public:
+    // Handle borrowed from the pool, goes back on destruction
+    class Lease
+    {
+    public:
+        Lease() = default;
+        Lease(LdapPool *pool, std::unique_ptr<LDAP_Module> handle);
+        Lease(Lease &&other) = default;
+        Lease &operator=(Lease &&other);
+        ~Lease();
+
+        explicit operator bool() const { return handle != nullptr; }
+        LDAP_Module *operator->() const { return handle.get(); }
+
+    private:
+        LdapPool *pool = nullptr;
+        std::unique_ptr<LDAP_Module> handle;
+
+        void release();
+    };
+
+    explicit LdapPool(const LdapPoolConfig &config = LdapPoolConfig());
+
+    LdapPool(const LdapPool &) = delete;
+    LdapPool &operator=(const LdapPool &) = delete;
+
+    // Waits up to acquire_timeout for a healthy handle, an empty lease if none became free
+    Lease acquire();
+
+    // Like acquire() but never waits, for callers that must not block (reactor)
+    Lease try_acquire();
+
+private:
+    struct IdleHandle
+    {
+        std::unique_ptr<LDAP_Module> handle;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    LdapPoolConfig config;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<IdleHandle> idle; // most recently used at the back
+    size_t created = 0;           // idle + leased
+
+    Lease acquire_until(std::chrono::steady_clock::time_point deadline);
+    std::unique_ptr<LDAP_Module> create_handle();
+    void give_back(std::unique_ptr<LDAP_Module> handle);
+};
+
+#endif // LDAP_POOL_H
@@ -0,0 +1,172 @@
+#include "directory_mail_store.h"
+#include "mailbox_index.h"
+#include "mailbox_lock.h"
+#include "record_io.h"
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../utils/log.h"
+
+DirectoryMailStore::DirectoryMailStore(const fs::path &mail_directory, Durability durability)
+: mail_directory(mail_directory)
+, durability(durability)
+{}
+
+bool DirectoryMailStore::append(const std::string &receiver, const std::string &sender, std::string_view subject, std::string_view content)
+{
+  bool sync = durability == Durability::FsyncPerMessage;
+  std::time_t timestamp = std::time(nullptr);
+  fs::path receiver_inbox = mail_directory / receiver;
+
+  // only the receiver's inbox is locked, senders to other users run in parallel
+  if (fs::create_directories(receiver_inbox) && sync && !sync_directory(mail_directory))
+  {
+    return false;
+  }
+  MailboxLock lock(receiver_inbox, MailboxLock::Mode::Exclusive);
+
+  // the index has to exist before the new file is written, a rebuild would pick it up twice
+  MailboxIndex index(receiver_inbox, durability != Durability::None);
+  MailboxView &view = cached_view(receiver);
+  if (!lock.locked() || !index.refresh(view))
+  {
+    return false;
+  }
+
+  // written under a dot name, which a rebuild skips, and renamed once complete:
+  // the message file is either missing or whole, also after a crash
+  uint64_t id = view.max_id + 1;
+  std::string file_name = std::to_string(id) + "-" + std::to_string(timestamp) + "_" + sender + ".txt";
+  fs::path message_path = receiver_inbox / file_name;
+  fs::path temp_path = receiver_inbox / ("." + file_name + ".tmp");
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    LOG_ERROR("Unable to create message file in " << receiver_inbox);
+    return false;
+  }
+  bool written = write_all(fd, content.data(), content.size()) && (!sync || fdatasync(fd) == 0);
+  close(fd);
+  if (!written || rename(temp_path.c_str(), message_path.c_str()) != 0)
+  {
+    LOG_ERROR("Unable to write message file " << message_path << ": " << std::strerror(errno));
+    unlink(temp_path.c_str());
+    return false;
+  }
+
+  // the rename has to be on disk before the index entry pointing to the file
+  if ((sync && !sync_directory(receiver_inbox)) || !index.append(view, id, sender, subject, file_name, timestamp, sync))
+  {
+    fs::remove(message_path);
+    return false;
+  }
+  return true;
+}
+
+bool DirectoryMailStore::commit()
+{
+  return durability != Durability::GroupCommit || sync_file_system(mail_directory);
+}
+
+bool DirectoryMailStore::list(const std::string &user, std::pmr::vector<MessageInfo> &messages)
+{
+  fs::path user_inbox = mail_directory / user;
+  if (!fs::is_directory(user_inbox))
+  {
+    return true;
+  }
+
+  // subjects come from the index, no message file is opened
+  MailboxLock lock(user_inbox, MailboxLock::Mode::Shared);
+  MailboxView &view = cached_view(user);
+  if (!lock.locked() || !MailboxIndex(user_inbox, durability != Durability::None).refresh(view))
+  {
+    return false;
+  }
+
+  messages.reserve(view.live_count);
+  for (const auto &entry : view.entries)
+  {
+    if (!entry.deleted)
+    {
+      messages.emplace_back(entry.id, entry.timestamp, entry.sender, entry.subject);
+    }
+  }
+  return true;
+}
+
+bool DirectoryMailStore::get(const std::string &user, uint64_t id, std::pmr::string &content)
+{
+  // the descriptor stays readable even if the message is deleted meanwhile
+  MessageFile file;
+  if (!open(user, id, file))
+  {
+    return false;
+  }
+  content.resize(file.length);
+  bool complete = read_at(file.fd, file.offset, &content[0], content.size()) == content.size();
+  close(file.fd);
+  return complete;
+}
+
+bool DirectoryMailStore::open(const std::string &user, uint64_t id, MessageFile &file)
+{
+  fs::path user_inbox = mail_directory / user;
+  if (!fs::is_directory(user_inbox))
+  {
+    return false;
+  }
+
+  MailboxLock lock(user_inbox, MailboxLock::Mode::Shared);
+  MailboxView &view = cached_view(user);
+  const IndexEntry *entry = lock.locked() && MailboxIndex(user_inbox, durability != Durability::None).refresh(view) ? view.find(id) : nullptr;
+  if (entry == nullptr)
+  {
+    return false;
+  }
+
+  // a DEL after the lock is released unlinks the file, the open descriptor keeps it readable
+  fs::path message_path = user_inbox / entry->file_name;
+  int fd = ::open(message_path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat file_stat;
+  if (fd == -1 || fstat(fd, &file_stat) != 0)
+  {
+    LOG_ERROR("Unable to open message file " << entry->file_name);
+    if (fd != -1)
+      close(fd);
+    return false;
+  }
+  file.fd = fd;
+  file.offset = 0;
+  file.length = file_stat.st_size;
+  return true;
+}
+
+bool DirectoryMailStore::remove(const std::string &user, uint64_t id)
+{
+  fs::path user_inbox = mail_directory / user;
+  if (!fs::is_directory(user_inbox))
+  {
+    return false;
+  }
+
+  MailboxLock lock(user_inbox, MailboxLock::Mode::Exclusive);
+  MailboxIndex index(user_inbox, durability != Durability::None);
+  MailboxView &view = cached_view(user);
+  const IndexEntry *entry = lock.locked() && index.refresh(view) ? view.find(id) : nullptr;
+  if (entry == nullptr)
+  {
+    return false;
+  }
+
+  // tombstone first: a crash in between leaves an unlisted file, never a dangling entry
+  fs::path message_path = user_inbox / entry->file_name;
+  if (!index.remove(view, id))
+  {
+    return false;
+  }
+  fs::remove(message_path);
+  return true;
+}
@@ -0,0 +1,27 @@
+#ifndef DIRECTORY_MAIL_STORE_H
+#define DIRECTORY_MAIL_STORE_H
+
+#include "mail_store.h"
+
+// The original spool layout: <spool>/<user>/<id>-<timestamp>_<sender>.txt per
+// message, listed through the inbox's MailboxIndex.
+class DirectoryMailStore : public MailStore
+{
+public:
+    DirectoryMailStore(const fs::path &mail_directory, Durability durability);
+
+    bool append(const std::string &receiver, const std::string &sender, std::string_view subject, std::string_view content) override;
+    bool list(const std::string &user, std::pmr::vector<MessageInfo> &messages) override;
+    bool get(const std::string &user, uint64_t id, std::pmr::string &content) override;
+    bool remove(const std::string &user, uint64_t id) override;
+    bool commit() override;
+
+    bool can_open() const override { return true; }
+    bool open(const std::string &user, uint64_t id, MessageFile &file) override;
+
+private:
+    fs::path mail_directory;
+    Durability durability;
+};
+
+#endif // DIRECTORY_MAIL_STORE_H
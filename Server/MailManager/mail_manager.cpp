@@ -1,264 +1,180 @@
 #include "mail_manager.h"
-#include <semaphore.h>
-#include <fstream>
-#include <iostream>
-#include <sys/socket.h>
+#include "record_io.h"
+#include <charconv>
+#include <unistd.h>
 #include "../../utils/constants.h"
 #include "../../utils/helpers.h"
+#include "../../utils/log.h"
 
-MailManager::MailManager(const std::filesystem::path &mail_directory)
-: mail_directory(mail_directory)
+MailManager::MailManager(MailStore &store)
+: store(store)
 {}
 
-void MailManager::handle_list(int consfd, const std::string &authenticated_user, sem_t *sem)
+// Decimal digits of value in buffer, which needs room for 20 characters
+static std::string_view format_number(char *buffer, uint64_t value)
 {
-  fs::path user_inbox = mail_directory / authenticated_user; // Path to the user's inbox
-  if (!fs::exists(user_inbox) || !fs::is_directory(user_inbox))
+  char *end = std::to_chars(buffer, buffer + 20, value).ptr;
+  return std::string_view(buffer, end - buffer);
+}
+
+// Message numbers are the stable ids shown by LIST, plain decimal
+static bool parse_message_nr(std::string_view message_nr_string, uint64_t &message_nr)
+{
+  auto result = std::from_chars(message_nr_string.data(), message_nr_string.data() + message_nr_string.size(), message_nr);
+  return result.ec == std::errc() && result.ptr == message_nr_string.data() + message_nr_string.size();
+}
+
+void MailManager::handle_list(OutputQueue &out, std::pmr::memory_resource &arena, const std::string &authenticated_user)
+{
+  std::pmr::vector<MessageInfo> messages(&arena);
+  if (!store.list(authenticated_user, messages))
   {
-    std::cout << "No messages or user unknown" << std::endl;
-    send_server_response(consfd, "0\n", 2, 0);
+    LOG_ERROR("Unable to read mailbox in LIST");
+    append_server_response(out, ServerConstants::RESPONSE_ERR, 4);
     return;
   }
 
-  int messageCount = 0;
-  std::ostringstream response;
-
-  // Iterate over the directory and gather subjects in one pass
-  int counter = 0;
-  sem_wait(sem);
-
-  for (const auto &entry : fs::directory_iterator(user_inbox))
+  // count line, then "[<id>] <subject>\n" per message, numbered by the stable message id.
+  // The lines go into the reply piece by piece, the length is summed up first.
+  char number[24];
+  std::string_view count = format_number(number, messages.size());
+  size_t content_length = count.size() + 1;
+  for (const auto &message : messages)
   {
-    counter++;
-
-    // lock Semaphore before iterating and reading through the files
-    if (fs::is_regular_file(entry.path()))
-    {
-      std::ifstream message_file(entry.path());
-      std::string line;
-      std::string subject;
-
-      std::getline(message_file, line); // skip receiver
-
-      if (std::getline(message_file, subject))
-      {
-        messageCount++;
-        response << "[" << counter << "] " << subject << "\n"; // Add subject to the response
-      }
-    }
+    content_length += format_number(number, message.id).size() + message.subject.size() + 4;
   }
-  sem_post(sem);
-
-  // Construct the final response with the count first
-  std::ostringstream finalResponse;
-  finalResponse << messageCount << "\n"; // Add the message count first
-  finalResponse << response.str();       // Append all subjects
 
-  // Send the complete response
-  send_server_response(consfd, finalResponse.str().c_str(), finalResponse.str().size(), 0);
+  ResponseWriter reply(out, content_length);
+  reply.write(format_number(number, messages.size())).write("\n");
+  for (const auto &message : messages)
+  {
+    reply.write("[").write(format_number(number, message.id)).write("] ").write(message.subject).write("\n");
+  }
 }
 
-void MailManager::handle_send(int consfd, const std::string &buffer, const std::string &authenticated_user, sem_t *sem)
+void MailManager::handle_send(OutputQueue &out, std::pmr::memory_resource &arena, std::string_view body, const std::string &authenticated_user)
 {
-  std::string skipLine;
-  std::string receiver;
-  std::string subject;
-  std::string message;
+  std::string_view receiver;
+  std::string_view subject;
 
-  std::istringstream iss(buffer);
-  std::getline(iss, skipLine, '\n'); // skip command and content-length header
-  std::getline(iss, skipLine, '\n');
-
-  if (!std::getline(iss, receiver) || receiver.empty())
+  if (!next_line(body, receiver) || receiver.empty())
   {
-    std::cout << "Invalid receiver in LIST" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
+    LOG_DEBUG("Invalid receiver in LIST");
+    append_server_response(out, ServerConstants::RESPONSE_ERR, 4);
     return;
   }
 
-  if (!std::getline(iss, subject) || subject.empty())
+  if (!next_line(body, subject) || subject.empty())
   {
-    std::cout << "Invalid subject in LIST" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
+    LOG_DEBUG("Invalid subject in LIST");
+    append_server_response(out, ServerConstants::RESPONSE_ERR, 4);
     return;
   }
 
-  std::string line;
-  while (std::getline(iss, line))
+  // stored content: receiver and subject line followed by the message lines up to "."
+  std::pmr::string content(&arena);
+  content.reserve(receiver.size() + subject.size() + body.size() + 2);
+  content.append(receiver).append("\n").append(subject).append("\n");
+
+  std::string_view line;
+  while (next_line(body, line))
   {
     if (line == ".")
       break;
     else
-      message += line + "\n";
+      content.append(line).append("\n");
   }
 
-  fs::path receiverPath = mail_directory / receiver / (std::to_string(std::time(nullptr)) + "_" + authenticated_user + ".txt");
-
-  sem_wait(sem); // lock Semaphore before creating a directory and writing to a new file
-  fs::create_directories(mail_directory / receiver);
-
-  std::ofstream message_file(receiverPath);
-  if (message_file.is_open())
+  if (!store.append(std::string(receiver), authenticated_user, subject, content))
   {
-    // Write the structured message
-    message_file << receiver << "\n";
-    message_file << subject << "\n";
-    message_file << message;
-
-    message_file.close();
-    sem_post(sem); // unlock semaphore after closing message_file
-
-    std::cout << "Saved Mail " << subject << " in inbox of " << receiver << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_OK, 3, 0);
-  }
-  else
-  {
-    sem_post(sem); // unlock semaphore if writing to file failed
-    std::cout << "Error while opening folder to save mail in SEND" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
+    LOG_ERROR("Error while saving mail in SEND");
+    append_server_response(out, ServerConstants::RESPONSE_ERR, 4);
+    return;
   }
+  LOG_DEBUG("Saved Mail " << subject << " in inbox of " << receiver);
+  append_server_response(out, ServerConstants::RESPONSE_OK, 3);
 }
 
-void MailManager::handle_read(int consfd, const std::string &buffer, const std::string &authenticated_user, sem_t *sem)
+void MailManager::handle_read(OutputQueue &out, std::pmr::memory_resource &arena, std::string_view body, const std::string &authenticated_user)
 {
-  std::string line;
-  std::string message_nr_string;
-
-  std::istringstream iss(buffer);
-  std::getline(iss, line, '\n'); // skip command and content-length header
-  std::getline(iss, line, '\n');
+  std::string_view message_nr_string;
 
-  if (!std::getline(iss, message_nr_string) || message_nr_string.empty())
+  if (!next_line(body, message_nr_string) || message_nr_string.empty())
   {
-    std::cout << "Invalid message number in READ" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
+    LOG_DEBUG("Invalid message number in READ");
+    append_server_response(out, ServerConstants::RESPONSE_ERR, 4);
     return;
   }
 
-  int message_nr = -1;
-  try
+  uint64_t message_nr = 0;
+  if (!parse_message_nr(message_nr_string, message_nr))
   {
-    message_nr = std::stoi(message_nr_string);
-  }
-  catch (const std::exception &e)
-  {
-    std::cout << e.what() << '\n';
-    std::cout << "Error while parsing message number in READ" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
-    return;
-  }
-
-  sem_wait(sem);                                           // Lock semaphore before checking file existance
-  fs::path user_inbox = mail_directory / authenticated_user; // Path to the user's inbox
-  if (!fs::exists(user_inbox) || !fs::is_directory(user_inbox))
-  {
-    sem_post(sem); // Unlock semaphore if dir doesnt exist
-
-    std::cout << "No messages for user " + authenticated_user + " in READ" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
+    LOG_DEBUG("Error while parsing message number in READ");
+    append_server_response(out, ServerConstants::RESPONSE_ERR, 4);
     return;
   }
 
-  int counter = 0;
-  for (const auto &entry : fs::directory_iterator(user_inbox))
+  std::string_view ok = ServerConstants::RESPONSE_OK;
+  std::pmr::string content(&arena);
+  MessageFile file;
+  bool found = false;
+  if (store.can_open() && store.open(authenticated_user, message_nr, file))
   {
-    counter++;
-    if (counter == message_nr)
+    if (file.length >= ServerConstants::SENDFILE_MIN_LENGTH)
     {
-      std::ifstream message_file(entry.path());
-      if (!message_file.is_open())
-      {
-        std::cout << "Unable to open message file in READ" << std::endl;
-        send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
-        return;
-      }
-
-      std::ostringstream message_content;
-      std::string line;
-
-      while (std::getline(message_file, line))
-      {
-        message_content << line << "\n";
-      }
-
-      sem_post(sem); // Unlock semaphore after reading the file
-
-      std::string response = ServerConstants::RESPONSE_OK + message_content.str() + "\n"; // Add an additional newline at the end
-      send_server_response(consfd, response.c_str(), response.size(), 0);
+      // zero copy: only the framing goes through user space, sendfile() sends the message
+      ResponseWriter(out, ok.size() + file.length + 1).write(ok).write_file(file.fd, file.offset, file.length).write("\n");
       return;
     }
-  }
-  sem_post(sem); // unlock after iterator finished
-
-  // invalid message number
-  std::cout << "Invalid message number in READ" << std::endl;
-  send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
-}
 
-void MailManager::handle_delete(int consfd, const std::string &buffer, const std::string &authenticated_user, sem_t *sem)
-{
-  std::string line;
-  std::string message_nr_string;
-
-  std::istringstream iss(buffer);
-  std::getline(iss, line, '\n'); // skip command and content-length header
-  std::getline(iss, line, '\n');
-
-  if (!std::getline(iss, message_nr_string) || message_nr_string.empty())
-  {
-    std::cout << "Invalid message number in DEL" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
-    return;
+    // small messages are cheaper to copy than to keep a descriptor queued for
+    content.resize(file.length);
+    found = read_at(file.fd, file.offset, &content[0], content.size()) == content.size();
+    close(file.fd);
   }
-
-  int message_nr = -1;
-  try
+  else if (!store.can_open())
   {
-    message_nr = std::stoi(message_nr_string);
+    found = store.get(authenticated_user, message_nr, content);
   }
-  catch (const std::exception &e)
+
+  if (!found)
   {
-    std::cout << e.what() << '\n';
-    std::cout << "Error while parsing message number in DEL" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
+    // invalid message number
+    LOG_DEBUG("Invalid message number in READ");
+    append_server_response(out, ServerConstants::RESPONSE_ERR, 4);
     return;
   }
+  // Add an additional newline at the end. The arena is reset once the request
+  // is answered, so the content is copied into the queue.
+  ResponseWriter(out, ok.size() + content.size() + 1).write(ok).write(content).write("\n");
+}
 
-  fs::path user_inbox = mail_directory / authenticated_user; // Path to the user's inbox
+void MailManager::handle_delete(OutputQueue &out, std::string_view body, const std::string &authenticated_user)
+{
+  std::string_view message_nr_string;
 
-  sem_wait(sem); // Lock semaphore before accessing the filesystem
-  if (!fs::exists(user_inbox) || !fs::is_directory(user_inbox))
+  if (!next_line(body, message_nr_string) || message_nr_string.empty())
   {
-    std::cout << "No messages or user unknown in DEL" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
-    sem_post(sem); // Unlock if dir doesnt exist
+    LOG_DEBUG("Invalid message number in DEL");
+    append_server_response(out, ServerConstants::RESPONSE_ERR, 4);
     return;
   }
 
-  int counter = 0;
-  bool message_deleted = false;
-  for (const auto &entry : fs::directory_iterator(user_inbox))
+  uint64_t message_nr = 0;
+  if (!parse_message_nr(message_nr_string, message_nr))
   {
-    counter++;
-    if (counter == message_nr)
-    {
-      // Attempt to delete the message file
-      if (fs::remove(entry.path()))
-      {
-        message_deleted = true; // Mark as found if deletion was successful
-        break;
-      }
-    }
+    LOG_DEBUG("Error while parsing message number in DEL");
+    append_server_response(out, ServerConstants::RESPONSE_ERR, 4);
+    return;
   }
-  sem_post(sem); // Unlock semaphore after deleting file
 
-  if (message_deleted)
+  if (store.remove(authenticated_user, message_nr))
   {
-    send_server_response(consfd, ServerConstants::RESPONSE_OK, 3, 0); // Message deleted successfully
+    append_server_response(out, ServerConstants::RESPONSE_OK, 3); // Message deleted successfully
   }
   else
   {
-    std::cout << "Error while deleting file in DEL" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
+    LOG_ERROR("Error while deleting file in DEL");
+    append_server_response(out, ServerConstants::RESPONSE_ERR, 4);
   }
-}
\ No newline at end of file
+}
@@ -1,22 +1,28 @@
 #ifndef MAIL_MANAGER_H
 #define MAIL_MANAGER_H
 
-#include <filesystem>
-#include <semaphore.h>
-
-namespace fs = std::filesystem;
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include "mail_store.h"
+#include "../../utils/output_queue.h"
 
+// Protocol side of the mail commands: parses the request bodies, calls the
+// MailStore and formats the replies.
 class MailManager 
 {
 public:
-    MailManager(const std::filesystem::path &mail_directory);
+    explicit MailManager(MailStore &store);
 
-    void handle_list(int consfd, const std::string &authenticated_user, sem_t *sem);
-    void handle_send(int consfd, const std::string &buffer, const std::string &authenticated_user, sem_t *sem);
-    void handle_read(int consfd, const std::string &buffer, const std::string &authenticated_user, sem_t *sem);
-    void handle_delete(int consfd, const std::string &buffer, const std::string &authenticated_user, sem_t *sem);
+    // replies are appended to out, the caller flushes them to the client;
+    // temporaries come from arena, which the caller resets after the request
+    void handle_list(OutputQueue &out, std::pmr::memory_resource &arena, const std::string &authenticated_user);
+    // body is the frame body, without command line and Content-Length header
+    void handle_send(OutputQueue &out, std::pmr::memory_resource &arena, std::string_view body, const std::string &authenticated_user);
+    void handle_read(OutputQueue &out, std::pmr::memory_resource &arena, std::string_view body, const std::string &authenticated_user);
+    void handle_delete(OutputQueue &out, std::string_view body, const std::string &authenticated_user);
     
 private:
-    std::filesystem::path mail_directory;
+    MailStore &store;
 };
-#endif //MAIL_MANAGER_H
\ No newline at end of file
+#endif //MAIL_MANAGER_H
@@ -0,0 +1,18 @@
+#include "mail_store.h"
+#include "directory_mail_store.h"
+#include "memory_mail_store.h"
+#include "segment_mail_store.h"
+
+std::unique_ptr<MailStore> create_mail_store(StorageLayout layout, const fs::path &mail_directory, Durability durability)
+{
+  switch (layout)
+  {
+  case StorageLayout::Segment:
+    return std::unique_ptr<MailStore>(new SegmentMailStore(mail_directory, durability));
+  case StorageLayout::Memory:
+    return std::unique_ptr<MailStore>(new MemoryMailStore());
+  case StorageLayout::Directory:
+  default:
+    return std::unique_ptr<MailStore>(new DirectoryMailStore(mail_directory, durability));
+  }
+}
@@ -0,0 +1,106 @@
+#ifndef MAIL_STORE_H
+#define MAIL_STORE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Where and how the messages are stored
+enum class StorageLayout
+{
+    Directory, // one file per message plus the .index file (MailboxIndex)
+    Segment,   // one append-only segment file per inbox (MailboxSegment)
+    Memory     // process memory only, for benchmarking without disk I/O
+};
+
+// When the OK of a SEND is sent, relative to the message reaching the disk.
+// Except for None, files rewritten by a compaction or an index rebuild are
+// synced before they replace the old ones.
+enum class Durability
+{
+    None,            // written to the page cache, the kernel flushes it later
+    FsyncPerMessage, // append() syncs the message and its index entry before returning
+    GroupCommit      // append() only writes, commit() syncs everything appended so far at once
+};
+
+// What LIST shows of a message. Allocator-aware, so a std::pmr::vector of
+// them keeps the strings in the same (request) arena as the vector itself.
+struct MessageInfo
+{
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+    uint64_t id = 0; // stable, never reused within an inbox
+    int64_t timestamp = 0;
+    std::pmr::string sender;
+    std::pmr::string subject;
+
+    MessageInfo() = default;
+    MessageInfo(uint64_t id, int64_t timestamp, std::string_view sender, std::string_view subject, const allocator_type &alloc = {})
+    : id(id), timestamp(timestamp), sender(sender, alloc), subject(subject, alloc) {}
+    MessageInfo(const MessageInfo &other) = default;
+    MessageInfo(MessageInfo &&other) = default;
+    MessageInfo(const MessageInfo &other, const allocator_type &alloc)
+    : id(other.id), timestamp(other.timestamp), sender(other.sender, alloc), subject(other.subject, alloc) {}
+    MessageInfo(MessageInfo &&other, const allocator_type &alloc)
+    : id(other.id), timestamp(other.timestamp), sender(std::move(other.sender), alloc), subject(std::move(other.subject), alloc) {}
+    MessageInfo &operator=(const MessageInfo &other) = default;
+    MessageInfo &operator=(MessageInfo &&other) = default;
+};
+
+// A stored message as a region of an open file, for sending it with sendfile()
+struct MessageFile
+{
+    int fd = -1;
+    off_t offset = 0;
+    size_t length = 0;
+};
+
+// Storage behind the mail commands. Backends only store and return data, the
+// protocol (parsing requests, formatting replies) stays in MailManager.
+//
+// content is the stored message: receiver line, subject line and the message
+// lines, each terminated by '\n'. Results are handed back in containers the
+// caller allocates, usually from its request arena. All methods may be called concurrently from
+// several threads or processes; false means the operation failed or, for get()
+// and remove(), that the message does not exist.
+class MailStore
+{
+public:
+    virtual ~MailStore() = default;
+
+    // Stores a message in the receiver's inbox under the next free id
+    virtual bool append(const std::string &receiver, const std::string &sender, std::string_view subject, std::string_view content) = 0;
+
+    // Live messages in id order, an unknown user has an empty inbox
+    virtual bool list(const std::string &user, std::pmr::vector<MessageInfo> &messages) = 0;
+
+    virtual bool get(const std::string &user, uint64_t id, std::pmr::string &content) = 0;
+
+    virtual bool remove(const std::string &user, uint64_t id) = 0;
+
+    // Group commit: makes every append() since the last call durable. The
+    // server calls it once for a batch of SENDs before releasing their OKs.
+    virtual bool commit() { return true; }
+
+    // Backends that keep messages in files can hand out the file instead of a
+    // copy of the content. The descriptor stays valid and unchanged even if the
+    // message is deleted or compacted meanwhile; the caller closes it.
+    virtual bool can_open() const { return false; }
+    virtual bool open(const std::string &user, uint64_t id, MessageFile &file) { return false; }
+
+    // Housekeeping the server runs from a background thread, e.g. compaction
+    virtual bool needs_maintenance() const { return false; }
+    virtual void maintain() {}
+};
+
+// durability only applies to the layouts on disk
+std::unique_ptr<MailStore> create_mail_store(StorageLayout layout, const fs::path &mail_directory, Durability durability);
+
+#endif // MAIL_STORE_H
@@ -0,0 +1,391 @@
+#include "mailbox_index.h"
+#include "record_io.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <ctime>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../utils/constants.h"
+#include "../../utils/log.h"
+
+static constexpr char INDEX_MAGIC[4] = {'T', 'W', 'M', 'I'};
+// version 1 headers have no file id, they are still read until the next rewrite
+static constexpr uint32_t INDEX_VERSION = 2;
+static constexpr size_t HEADER_SIZE = 16;
+static constexpr size_t HEADER_V1_SIZE = 8;
+
+// u32 length + u64 id + i64 timestamp + u8 deleted + 3 * u16 string lengths + u32 trailing length
+static constexpr size_t RECORD_OVERHEAD = 4 + 8 + 8 + 1 + 3 * 2 + 4;
+static constexpr size_t DELETED_FLAG_OFFSET = 4 + 8 + 8;
+
+// tombstones are only compacted away once there are this many and they outnumber live entries
+static constexpr size_t COMPACT_MIN_TOMBSTONES = 64;
+
+static std::string encode_record(uint64_t id, int64_t timestamp, bool deleted, std::string_view sender, std::string_view subject, std::string_view file_name)
+{
+  // u16 lengths, longer strings are cut
+  uint16_t sender_length = std::min<size_t>(sender.size(), UINT16_MAX);
+  uint16_t subject_length = std::min<size_t>(subject.size(), UINT16_MAX);
+  uint16_t file_name_length = std::min<size_t>(file_name.size(), UINT16_MAX);
+  uint32_t record_length = RECORD_OVERHEAD + sender_length + subject_length + file_name_length;
+
+  std::string record;
+  record.reserve(record_length);
+  put<uint32_t>(record, record_length);
+  put<uint64_t>(record, id);
+  put<int64_t>(record, timestamp);
+  put<uint8_t>(record, deleted ? 1 : 0);
+  put<uint16_t>(record, sender_length);
+  put<uint16_t>(record, subject_length);
+  put<uint16_t>(record, file_name_length);
+  record.append(sender, 0, sender_length);
+  record.append(subject, 0, subject_length);
+  record.append(file_name, 0, file_name_length);
+  put<uint32_t>(record, record_length);
+  return record;
+}
+
+// every rebuilt or compacted index gets a new file id
+static std::string index_header()
+{
+  std::string header(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  put<uint32_t>(header, INDEX_VERSION);
+  put<uint64_t>(header, new_file_id());
+  return header;
+}
+
+// records_start 0: no valid header, the index has to be rebuilt
+static void read_index_header(int fd, off_t file_size, uint64_t &file_id, off_t &records_start)
+{
+  file_id = 0;
+  records_start = 0;
+
+  char header[HEADER_SIZE];
+  size_t length = std::min<off_t>(file_size, HEADER_SIZE);
+  if (length < HEADER_V1_SIZE || read_at(fd, 0, header, length) != length || std::memcmp(header, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0)
+    return;
+
+  uint32_t version = get<uint32_t>(header + 4);
+  if (version == 1)
+  {
+    records_start = HEADER_V1_SIZE;
+  }
+  else if (version == INDEX_VERSION && length == HEADER_SIZE)
+  {
+    file_id = get<uint64_t>(header + 8);
+    records_start = HEADER_SIZE;
+  }
+}
+
+// Parses the records in data[pos..] into view, returns the offset after the last complete one
+static size_t apply_records(const std::string &data, size_t pos, MailboxView &view)
+{
+  while (pos < data.size())
+  {
+    const char *record = data.data() + pos;
+    size_t remaining = data.size() - pos;
+    if (remaining < RECORD_OVERHEAD)
+      break;
+
+    uint32_t record_length = get<uint32_t>(record);
+    if (record_length < RECORD_OVERHEAD || record_length > remaining ||
+        get<uint32_t>(record + record_length - 4) != record_length)
+      break;
+
+    uint16_t sender_length = get<uint16_t>(record + 21);
+    uint16_t subject_length = get<uint16_t>(record + 23);
+    uint16_t file_name_length = get<uint16_t>(record + 25);
+    if (RECORD_OVERHEAD + sender_length + subject_length + file_name_length != record_length)
+      break;
+    pos += record_length;
+
+    uint64_t id = get<uint64_t>(record + 4);
+    bool deleted = record[DELETED_FLAG_OFFSET] != 0;
+
+    auto known = view.positions.find(id);
+    if (known != view.positions.end())
+    {
+      // tombstone for an earlier record
+      IndexEntry &entry = view.entries[known->second];
+      if (deleted && !entry.deleted)
+      {
+        entry.deleted = true;
+        view.live_count--;
+      }
+      continue;
+    }
+
+    IndexEntry entry;
+    entry.id = id;
+    entry.timestamp = get<int64_t>(record + 12);
+    entry.deleted = deleted;
+    const char *strings = record + RECORD_OVERHEAD - 4;
+    entry.sender.assign(strings, sender_length);
+    entry.subject.assign(strings + sender_length, subject_length);
+    entry.file_name.assign(strings + sender_length + subject_length, file_name_length);
+
+    view.positions[id] = view.entries.size();
+    view.entries.push_back(std::move(entry));
+    view.max_id = std::max(view.max_id, id);
+    if (!deleted)
+      view.live_count++;
+  }
+  return pos;
+}
+
+const IndexEntry *MailboxView::find(uint64_t id) const
+{
+  auto position = positions.find(id);
+  if (position == positions.end() || entries[position->second].deleted)
+    return nullptr;
+  return &entries[position->second];
+}
+
+MailboxView &cached_view(const std::string &user)
+{
+  thread_local std::unordered_map<std::string, MailboxView> mailbox_views;
+
+  if (mailbox_views.size() >= ServerConstants::MAX_CACHED_MAILBOXES && mailbox_views.find(user) == mailbox_views.end())
+  {
+    mailbox_views.clear(); // views are only a cache, they are rebuilt from the files
+  }
+  return mailbox_views[user];
+}
+
+MailboxIndex::MailboxIndex(const fs::path &user_inbox, bool sync_rewrites)
+: user_inbox(user_inbox)
+, index_path(user_inbox / ".index")
+, sync_rewrites(sync_rewrites)
+{}
+
+bool MailboxIndex::refresh(MailboxView &view)
+{
+  int fd = open(index_path.c_str(), O_RDONLY);
+  if (fd == -1 && errno == ENOENT)
+  {
+    // inbox from before the index existed
+    if (!rebuild())
+      return false;
+    fd = open(index_path.c_str(), O_RDONLY);
+  }
+  if (fd == -1)
+  {
+    LOG_ERROR("Unable to open mailbox index " << index_path << ": " << std::strerror(errno));
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  uint64_t file_id;
+  off_t records_start;
+  read_index_header(fd, file_stat.st_size, file_id, records_start);
+  if (records_start == 0)
+  {
+    LOG_WARNING("Mailbox index " << index_path << " is damaged, rebuilding it");
+    close(fd);
+    view = MailboxView();
+    return rebuild() && refresh(view);
+  }
+
+  if (file_id != view.file_id || file_stat.st_size < view.size)
+  {
+    // first use or compacted meanwhile: start over
+    view = MailboxView();
+    view.file_id = file_id;
+  }
+  if (file_stat.st_size == view.size)
+  {
+    close(fd);
+    return true;
+  }
+
+  // only the part appended since the last refresh is read
+  off_t start = std::max(view.size, records_start);
+  std::string data(file_stat.st_size - start, '\0');
+  size_t length = read_at(fd, start, &data[0], data.size());
+  close(fd);
+  if (length != data.size())
+  {
+    // shorter than fstat() said or unreadable, nothing is concluded from it
+    LOG_ERROR("Unable to read mailbox index " << index_path);
+    view = MailboxView();
+    return false;
+  }
+
+  // Parsing stops at a record that is incomplete or damaged, the rest of the
+  // file stays where it is. Only append() cuts it off, under the exclusive lock.
+  view.size = start + apply_records(data, 0, view);
+  return true;
+}
+
+bool MailboxIndex::append(MailboxView &view, uint64_t id, const std::string &sender, std::string_view subject, const std::string &file_name, int64_t timestamp, bool sync)
+{
+  return append_record(view, encode_record(id, timestamp, false, sender, subject, file_name), sync);
+}
+
+bool MailboxIndex::remove(MailboxView &view, uint64_t id)
+{
+  if (view.find(id) == nullptr)
+    return false;
+
+  if (!append_record(view, encode_record(id, std::time(nullptr), true, "", "", "")))
+    return false;
+
+  compact_if_needed(view);
+  return true;
+}
+
+bool MailboxIndex::append_record(MailboxView &view, const std::string &record, bool sync)
+{
+  int fd = open(index_path.c_str(), O_WRONLY | O_APPEND);
+  if (fd == -1)
+  {
+    LOG_ERROR("Unable to open mailbox index " << index_path << ": " << std::strerror(errno));
+    return false;
+  }
+
+  // view was refreshed under the same exclusive lock, so whatever follows its
+  // last complete record is left over from an interrupted append
+  struct stat file_stat;
+  bool written = fstat(fd, &file_stat) == 0;
+  if (written && file_stat.st_size > view.size)
+  {
+    LOG_WARNING("Truncating partial record at the end of " << index_path);
+    written = ftruncate(fd, view.size) == 0;
+  }
+
+  written = written && write_all(fd, record) && (!sync || fdatasync(fd) == 0);
+  if (!written && ftruncate(fd, view.size) != 0)
+  {
+    LOG_ERROR("Unable to roll back partial index record: " << std::strerror(errno));
+  }
+  close(fd);
+
+  // picks up just the record written above
+  return written && refresh(view);
+}
+
+void MailboxIndex::compact_if_needed(MailboxView &view)
+{
+  size_t tombstones = view.entries.size() - view.live_count;
+  if (tombstones < COMPACT_MIN_TOMBSTONES || tombstones <= view.live_count)
+    return;
+
+  // the highest id stays as a tombstone so it is never handed out again
+  std::vector<IndexEntry> kept;
+  for (const auto &entry : view.entries)
+  {
+    if (!entry.deleted || entry.id == view.max_id)
+      kept.push_back(entry);
+  }
+
+  LOG_INFO("Compacting " << index_path << ", dropping " << view.entries.size() - kept.size() << " deleted entries");
+  if (write_index(kept))
+  {
+    view = MailboxView(); // new file id, the next refresh reads the compacted file
+  }
+}
+
+bool MailboxIndex::rebuild()
+{
+  std::vector<IndexEntry> entries;
+  uint64_t max_id = 0;
+
+  if (fs::is_directory(user_inbox))
+  {
+    for (const auto &dir_entry : fs::directory_iterator(user_inbox))
+    {
+      std::string name = dir_entry.path().filename().string();
+      if (!dir_entry.is_regular_file() || name[0] == '.')
+        continue;
+
+      // <id>-<timestamp>_<sender>.txt, or <timestamp>_<sender>.txt from before ids existed
+      IndexEntry entry;
+      entry.file_name = name;
+      std::string stem = dir_entry.path().stem().string();
+      size_t id_end = stem.find('-');
+      size_t separator = stem.find('_');
+      if (id_end != std::string::npos && id_end < separator)
+      {
+        std::from_chars(stem.data(), stem.data() + id_end, entry.id);
+        stem.erase(0, id_end + 1);
+        separator = stem.find('_');
+      }
+      if (separator != std::string::npos)
+      {
+        std::from_chars(stem.data(), stem.data() + separator, entry.timestamp);
+        entry.sender = stem.substr(separator + 1);
+      }
+
+      std::ifstream message_file(dir_entry.path());
+      std::string line;
+      std::getline(message_file, line); // skip receiver
+      std::getline(message_file, entry.subject);
+
+      max_id = std::max(max_id, entry.id);
+      entries.push_back(std::move(entry));
+    }
+  }
+
+  // legacy messages get fresh ids after the known ones, in arrival order
+  std::sort(entries.begin(), entries.end(), [](const IndexEntry &a, const IndexEntry &b)
+  {
+    return a.timestamp != b.timestamp ? a.timestamp < b.timestamp : a.file_name < b.file_name;
+  });
+  for (auto &entry : entries)
+  {
+    if (entry.id == 0)
+      entry.id = ++max_id;
+  }
+  std::sort(entries.begin(), entries.end(), [](const IndexEntry &a, const IndexEntry &b)
+  {
+    return a.id < b.id;
+  });
+
+  LOG_INFO("Rebuilt mailbox index " << index_path << " with " << entries.size() << " messages");
+  return write_index(entries);
+}
+
+bool MailboxIndex::write_index(const std::vector<IndexEntry> &entries)
+{
+  std::string data = index_header();
+  for (const auto &entry : entries)
+  {
+    data += encode_record(entry.id, entry.timestamp, entry.deleted, entry.sender, entry.subject, entry.file_name);
+  }
+
+  // readers either see the old or the new file. The temporary name is unique because
+  // two LIST/READ requests holding the shared lock may rebuild a missing index together.
+  std::string temp_path = (user_inbox / ".index.XXXXXX").string();
+  int fd = mkstemp(&temp_path[0]);
+  if (fd == -1)
+  {
+    LOG_ERROR("Unable to write mailbox index " << temp_path << ": " << std::strerror(errno));
+    return false;
+  }
+  bool written = fchmod(fd, 0644) == 0 && write_all(fd, data) && (!sync_rewrites || fdatasync(fd) == 0);
+  close(fd);
+
+  if (!written || rename(temp_path.c_str(), index_path.c_str()) != 0)
+  {
+    LOG_ERROR("Unable to replace mailbox index " << index_path);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  if (sync_rewrites && !sync_directory(user_inbox))
+  {
+    LOG_ERROR("Unable to sync the rename of " << index_path << ": " << std::strerror(errno));
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,100 @@
+#ifndef MAILBOX_INDEX_H
+#define MAILBOX_INDEX_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct IndexEntry
+{
+    uint64_t id = 0;
+    int64_t timestamp = 0;
+    bool deleted = false;
+    std::string sender;
+    std::string subject;
+    std::string file_name; // message file inside the inbox
+
+    // segment layout: position of the message content inside the segment file
+    off_t content_offset = 0;
+    uint32_t content_length = 0;
+};
+
+// In-memory state of one index or segment file: the messages in id order plus an id lookup
+// table, so READ and DEL resolve a message number in constant time.
+struct MailboxView
+{
+    // file the view was built from, by the id in its header: a compacted or
+    // rebuilt file is a new one with a new id, even if it got the old inode back
+    uint64_t file_id = 0;
+    // end of the last complete record
+    off_t size = 0;
+
+    uint64_t max_id = 0;
+    size_t live_count = 0;
+    std::vector<IndexEntry> entries;                  // ascending ids, deleted ones included
+    std::unordered_map<uint64_t, size_t> positions;   // id -> position in entries
+
+    // nullptr if the id is unknown or deleted
+    const IndexEntry *find(uint64_t id) const;
+};
+
+// Per-thread cache of views by user, kept in sync with the files on every access.
+// Readers of the same inbox in different threads refresh their own views concurrently.
+MailboxView &cached_view(const std::string &user);
+
+// Per-user index file (<inbox>/.index) so LIST does not have to open every message.
+//
+// After a 16 byte file header ("TWMI" + format version + random u64 file id) the
+// file is a sequence of records, appended with a single write():
+//
+//   u32 record length | u64 id | i64 timestamp | u8 deleted |
+//   u16 sender length | u16 subject length | u16 file name length |
+//   sender | subject | file name | u32 record length
+//
+// Message ids are stable, they are never reused or renumbered. DEL appends a
+// tombstone record (deleted = 1, no strings) for the id, so the file only ever
+// grows between compactions and a cached MailboxView catches up by reading the
+// new tail. Once tombstones outnumber live entries the file is rewritten through
+// a temporary file and rename(), under a new file id. Inboxes created before
+// the index existed are indexed from their message files on first access. A
+// record cut short by a crash is ignored by refresh() and cut off by the next
+// append.
+//
+// Callers hold the inbox's MailboxLock: shared for refresh(), exclusive for changes.
+class MailboxIndex
+{
+public:
+    // sync_rewrites: a rebuilt or compacted index is on disk before it replaces
+    // the old one
+    explicit MailboxIndex(const fs::path &user_inbox, bool sync_rewrites = false);
+
+    // Brings view up to date with the index file, reading only what was appended
+    // since the last call. Creates a missing index from the message files.
+    bool refresh(MailboxView &view);
+
+    // Adds a message under id, which must be view.max_id + 1; sync: fdatasync()
+    // the entry before returning
+    bool append(MailboxView &view, uint64_t id, const std::string &sender, std::string_view subject, const std::string &file_name, int64_t timestamp, bool sync = false);
+
+    bool remove(MailboxView &view, uint64_t id);
+
+    // Recreates the index from the message files in the inbox
+    bool rebuild();
+
+private:
+    fs::path user_inbox;
+    fs::path index_path;
+    bool sync_rewrites;
+
+    bool append_record(MailboxView &view, const std::string &record, bool sync = false);
+    void compact_if_needed(MailboxView &view);
+    bool write_index(const std::vector<IndexEntry> &entries);
+};
+
+#endif // MAILBOX_INDEX_H
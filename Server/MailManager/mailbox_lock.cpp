@@ -0,0 +1,110 @@
+#include "mailbox_lock.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <pthread.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <unordered_set>
+#include "../../utils/log.h"
+
+// Descriptors of the locks this process holds. A child forked while another
+// thread (e.g. the compactor) holds a lock inherits the descriptor and with it
+// the lock, which then outlives the parent's release and blocks the child's
+// next Exclusive lock on that inbox forever. The child closes its copies right
+// after fork(); opening and closing a lock is serialized against fork().
+struct HeldLocks
+{
+  std::mutex mutex;
+  std::unordered_set<int> fds;
+};
+
+static HeldLocks &held_locks();
+
+static void before_fork()
+{
+  held_locks().mutex.lock();
+}
+
+static void after_fork_parent()
+{
+  held_locks().mutex.unlock();
+}
+
+// the parent's descriptors stay open, its locks stay held
+static void after_fork_child()
+{
+  HeldLocks &held = held_locks();
+  for (int fd : held.fds)
+  {
+    close(fd);
+  }
+  held.fds.clear();
+  held.mutex.unlock();
+}
+
+// never destroyed, the fork handlers may still run during exit
+static HeldLocks &held_locks()
+{
+  static HeldLocks *held = []
+  {
+    HeldLocks *instance = new HeldLocks();
+    pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+    return instance;
+  }();
+  return *held;
+}
+
+static int open_lock(const fs::path &lock_path)
+{
+  HeldLocks &held = held_locks();
+  std::lock_guard<std::mutex> guard(held.mutex);
+  int fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd != -1)
+  {
+    held.fds.insert(fd);
+  }
+  return fd;
+}
+
+// closing the last descriptor of the open file releases the lock
+static void close_lock(int fd)
+{
+  HeldLocks &held = held_locks();
+  std::lock_guard<std::mutex> guard(held.mutex);
+  held.fds.erase(fd);
+  close(fd);
+}
+
+MailboxLock::MailboxLock(const fs::path &user_inbox, Mode mode)
+: lock_fd(-1)
+{
+  fs::path lock_path = user_inbox / ".lock";
+  int fd = open_lock(lock_path);
+  if (fd == -1)
+  {
+    LOG_ERROR("Unable to open mailbox lock " << lock_path << ": " << std::strerror(errno));
+    return;
+  }
+
+  int operation = mode == Mode::Shared ? LOCK_SH : LOCK_EX;
+  while (flock(fd, operation) == -1)
+  {
+    if (errno != EINTR)
+    {
+      LOG_ERROR("Unable to lock mailbox " << lock_path << ": " << std::strerror(errno));
+      close_lock(fd);
+      return;
+    }
+  }
+  lock_fd = fd;
+}
+
+MailboxLock::~MailboxLock()
+{
+  if (lock_fd != -1)
+  {
+    close_lock(lock_fd);
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef MAILBOX_LOCK_H
+#define MAILBOX_LOCK_H
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Reader/writer lock for one inbox, held for the lifetime of the object.
+//
+// Implemented as flock() on <inbox>/.lock. Every lock opens its own descriptor,
+// so it excludes forked children as well as other threads of the same process,
+// and operations on different inboxes never contend. A forked child does not
+// inherit the locks its parent holds, see mailbox_lock.cpp.
+class MailboxLock
+{
+public:
+    enum class Mode
+    {
+        Shared,   // LIST, READ
+        Exclusive // SEND, DEL
+    };
+
+    MailboxLock(const fs::path &user_inbox, Mode mode);
+    ~MailboxLock();
+
+    MailboxLock(const MailboxLock &) = delete;
+    MailboxLock &operator=(const MailboxLock &) = delete;
+
+    bool locked() const { return lock_fd != -1; }
+
+private:
+    int lock_fd;
+};
+
+#endif // MAILBOX_LOCK_H
@@ -0,0 +1,407 @@
+#include "mailbox_segment.h"
+#include "record_io.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../utils/constants.h"
+#include "../../utils/log.h"
+
+static constexpr char SEGMENT_MAGIC[4] = {'T', 'W', 'M', 'S'};
+// version 1 headers have no file id, they are still read and compacted into version 2
+static constexpr uint32_t SEGMENT_VERSION = 2;
+static constexpr size_t HEADER_SIZE = 16;
+static constexpr size_t HEADER_V1_SIZE = 8;
+
+// u32 length + u64 id + i64 timestamp + u8 deleted + 2 * u16 string lengths + u32 content length
+static constexpr size_t FIXED_FIELDS_SIZE = 4 + 8 + 8 + 1 + 2 * 2 + 4;
+// ... + u32 trailing length
+static constexpr size_t RECORD_OVERHEAD = FIXED_FIELDS_SIZE + 4;
+static constexpr size_t DELETED_FLAG_OFFSET = 4 + 8 + 8;
+
+// compaction copies records through a buffer of this size
+static constexpr size_t COMPACT_BUFFER_SIZE = 1024 * 1024;
+
+static std::string encode_record(uint64_t id, int64_t timestamp, bool deleted, std::string_view sender, std::string_view subject, std::string_view content)
+{
+  // u16 lengths, longer strings are cut
+  uint16_t sender_length = std::min<size_t>(sender.size(), UINT16_MAX);
+  uint16_t subject_length = std::min<size_t>(subject.size(), UINT16_MAX);
+  uint32_t content_length = content.size();
+  uint32_t record_length = RECORD_OVERHEAD + sender_length + subject_length + content_length;
+
+  std::string record;
+  record.reserve(record_length);
+  put<uint32_t>(record, record_length);
+  put<uint64_t>(record, id);
+  put<int64_t>(record, timestamp);
+  put<uint8_t>(record, deleted ? 1 : 0);
+  put<uint16_t>(record, sender_length);
+  put<uint16_t>(record, subject_length);
+  put<uint32_t>(record, content_length);
+  record.append(sender, 0, sender_length);
+  record.append(subject, 0, subject_length);
+  record.append(content.data(), content.size());
+  put<uint32_t>(record, record_length);
+  return record;
+}
+
+// every new or compacted segment gets a new file id
+static std::string segment_header()
+{
+  std::string header(SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+  put<uint32_t>(header, SEGMENT_VERSION);
+  put<uint64_t>(header, new_file_id());
+  return header;
+}
+
+// false if the header is damaged. records_start 0: the file is too short for
+// a header, the first append was interrupted and left no records.
+static bool read_segment_header(int fd, off_t file_size, uint64_t &file_id, off_t &records_start)
+{
+  file_id = 0;
+  records_start = 0;
+  if (file_size < static_cast<off_t>(HEADER_V1_SIZE))
+    return true;
+
+  char header[HEADER_SIZE];
+  size_t length = std::min<off_t>(file_size, HEADER_SIZE);
+  if (read_at(fd, 0, header, length) != length || std::memcmp(header, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0)
+    return false;
+
+  uint32_t version = get<uint32_t>(header + 4);
+  if (version == 1)
+  {
+    records_start = HEADER_V1_SIZE;
+  }
+  else if (version != SEGMENT_VERSION)
+  {
+    return false;
+  }
+  else if (length == HEADER_SIZE)
+  {
+    file_id = get<uint64_t>(header + 8);
+    records_start = HEADER_SIZE;
+  }
+  return true;
+}
+
+static size_t record_size(const IndexEntry &entry)
+{
+  return RECORD_OVERHEAD + entry.sender.size() + entry.subject.size() + entry.content_length;
+}
+
+MailboxSegment::MailboxSegment(const fs::path &user_inbox)
+: segment_path(user_inbox / "mailbox.seg")
+{}
+
+bool MailboxSegment::exists(const fs::path &user_inbox)
+{
+  struct stat file_stat;
+  return stat((user_inbox / "mailbox.seg").c_str(), &file_stat) == 0;
+}
+
+bool MailboxSegment::refresh(MailboxView &view)
+{
+  int fd = open(segment_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    if (errno == ENOENT)
+    {
+      // nothing was ever delivered to this inbox
+      view = MailboxView();
+      return true;
+    }
+    LOG_ERROR("Unable to open mailbox segment " << segment_path << ": " << std::strerror(errno));
+    return false;
+  }
+
+  struct stat file_stat;
+  uint64_t file_id;
+  off_t records_start;
+  if (fstat(fd, &file_stat) != 0 || !read_segment_header(fd, file_stat.st_size, file_id, records_start))
+  {
+    // unlike the index the segment holds the messages themselves, it is never rebuilt
+    LOG_ERROR("Mailbox segment " << segment_path << " is damaged");
+    close(fd);
+    return false;
+  }
+
+  if (records_start == 0)
+  {
+    // no complete header yet, the next append() starts the file over
+    view = MailboxView();
+    close(fd);
+    return true;
+  }
+  if (file_id != view.file_id || file_stat.st_size < view.size)
+  {
+    // first use or compacted meanwhile: start over
+    view = MailboxView();
+    view.file_id = file_id;
+  }
+  if (file_stat.st_size == view.size)
+  {
+    close(fd);
+    return true;
+  }
+
+  off_t pos = std::max(view.size, records_start);
+  // only the headers are read, the content is skipped until a READ asks for it
+  // Reading stops at a record that is incomplete or damaged, the rest of the
+  // file stays where it is. Only append() cuts it off, under the exclusive lock.
+  std::string strings;
+  bool failed = false;
+  while (file_stat.st_size - pos >= static_cast<off_t>(RECORD_OVERHEAD))
+  {
+    char fields[FIXED_FIELDS_SIZE];
+    if (read_at(fd, pos, fields, FIXED_FIELDS_SIZE) != FIXED_FIELDS_SIZE)
+    {
+      failed = true;
+      break;
+    }
+
+    uint32_t record_length = get<uint32_t>(fields);
+    uint16_t sender_length = get<uint16_t>(fields + 21);
+    uint16_t subject_length = get<uint16_t>(fields + 23);
+    uint32_t content_length = get<uint32_t>(fields + 25);
+    if (static_cast<uint64_t>(RECORD_OVERHEAD) + sender_length + subject_length + content_length != record_length ||
+        record_length > file_stat.st_size - pos)
+      break;
+
+    char trailer[4];
+    if (read_at(fd, pos + record_length - 4, trailer, 4) != 4)
+    {
+      failed = true;
+      break;
+    }
+    if (get<uint32_t>(trailer) != record_length)
+      break;
+
+    uint64_t id = get<uint64_t>(fields + 4);
+    bool deleted = fields[DELETED_FLAG_OFFSET] != 0;
+
+    auto known = view.positions.find(id);
+    if (known != view.positions.end())
+    {
+      // tombstone for an earlier record
+      IndexEntry &entry = view.entries[known->second];
+      if (deleted && !entry.deleted)
+      {
+        entry.deleted = true;
+        view.live_count--;
+      }
+      pos += record_length;
+      continue;
+    }
+
+    strings.resize(sender_length + subject_length);
+    if (read_at(fd, pos + FIXED_FIELDS_SIZE, &strings[0], strings.size()) != strings.size())
+    {
+      failed = true;
+      break;
+    }
+
+    IndexEntry entry;
+    entry.id = id;
+    entry.timestamp = get<int64_t>(fields + 12);
+    entry.deleted = deleted;
+    entry.sender.assign(strings, 0, sender_length);
+    entry.subject.assign(strings, sender_length, subject_length);
+    entry.content_offset = pos + FIXED_FIELDS_SIZE + strings.size();
+    entry.content_length = content_length;
+
+    view.positions[id] = view.entries.size();
+    view.entries.push_back(std::move(entry));
+    view.max_id = std::max(view.max_id, id);
+    if (!deleted)
+      view.live_count++;
+    pos += record_length;
+  }
+  close(fd);
+
+  if (failed)
+  {
+    // shorter than fstat() said or unreadable, nothing is concluded from it
+    LOG_ERROR("Unable to read mailbox segment " << segment_path);
+    view = MailboxView();
+    return false;
+  }
+  view.size = pos;
+  return true;
+}
+
+bool MailboxSegment::append(MailboxView &view, uint64_t id, const std::string &sender, std::string_view subject, std::string_view content, int64_t timestamp, bool sync)
+{
+  return append_record(view, encode_record(id, timestamp, false, sender, subject, content), sync);
+}
+
+int MailboxSegment::open_file() const
+{
+  int fd = open(segment_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    LOG_ERROR("Unable to open mailbox segment " << segment_path << ": " << std::strerror(errno));
+  }
+  return fd;
+}
+
+bool MailboxSegment::read(const IndexEntry &entry, char *content) const
+{
+  int fd = open_file();
+  if (fd == -1)
+  {
+    return false;
+  }
+
+  bool complete = read_at(fd, entry.content_offset, content, entry.content_length) == entry.content_length;
+  close(fd);
+  return complete;
+}
+
+bool MailboxSegment::remove(MailboxView &view, uint64_t id)
+{
+  if (view.find(id) == nullptr)
+    return false;
+
+  return append_record(view, encode_record(id, std::time(nullptr), true, "", "", std::string_view()));
+}
+
+bool MailboxSegment::append_record(MailboxView &view, const std::string &record, bool sync)
+{
+  int fd = open(segment_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    LOG_ERROR("Unable to open mailbox segment " << segment_path << ": " << std::strerror(errno));
+    return false;
+  }
+
+  // view was refreshed under the same exclusive lock, so whatever follows its
+  // last complete record is left over from an interrupted append
+  struct stat file_stat;
+  bool written = fstat(fd, &file_stat) == 0;
+  if (written && file_stat.st_size > view.size)
+  {
+    LOG_WARNING("Truncating partial record at the end of " << segment_path);
+    written = ftruncate(fd, view.size) == 0;
+    file_stat.st_size = view.size;
+  }
+
+  // a new segment gets its header with the first record, still in one write()
+  bool created = written && file_stat.st_size == 0;
+  if (created)
+  {
+    written = write_all(fd, segment_header() + record);
+  }
+  else if (written)
+  {
+    written = write_all(fd, record);
+  }
+  if (written && sync)
+  {
+    written = fdatasync(fd) == 0 && (!created || sync_directory(segment_path.parent_path()));
+  }
+  if (!written && ftruncate(fd, view.size) != 0)
+  {
+    LOG_ERROR("Unable to roll back partial segment record: " << std::strerror(errno));
+  }
+  close(fd);
+
+  // picks up just the record written above
+  return written && refresh(view);
+}
+
+bool MailboxSegment::needs_compaction(const MailboxView &view)
+{
+  if (view.size == 0)
+    return false;
+
+  size_t live_bytes = HEADER_SIZE;
+  for (const auto &entry : view.entries)
+  {
+    if (!entry.deleted)
+      live_bytes += record_size(entry);
+  }
+  size_t dead_bytes = view.size - live_bytes;
+  return dead_bytes >= ServerConstants::SEGMENT_COMPACT_MIN_DEAD_BYTES && dead_bytes * 2 >= static_cast<size_t>(view.size);
+}
+
+bool MailboxSegment::compact(MailboxView &view, bool sync)
+{
+  int source_fd = open(segment_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (source_fd == -1)
+  {
+    LOG_ERROR("Unable to open mailbox segment " << segment_path << ": " << std::strerror(errno));
+    return false;
+  }
+
+  std::string temp_path = segment_path.string() + ".XXXXXX";
+  int fd = mkstemp(&temp_path[0]);
+  if (fd == -1)
+  {
+    LOG_ERROR("Unable to create compacted segment " << temp_path << ": " << std::strerror(errno));
+    close(source_fd);
+    return false;
+  }
+
+  // the highest id stays as a tombstone so it is never handed out again
+  size_t kept = 0;
+  bool written = fchmod(fd, 0644) == 0;
+  std::string buffer = segment_header();
+  std::string content;
+  for (const auto &entry : view.entries)
+  {
+    if (!written)
+      break;
+
+    if (entry.deleted)
+    {
+      if (entry.id == view.max_id)
+      {
+        buffer += encode_record(entry.id, entry.timestamp, true, "", "", std::string_view());
+        kept++;
+      }
+      continue;
+    }
+
+    content.resize(entry.content_length);
+    if (read_at(source_fd, entry.content_offset, &content[0], content.size()) != content.size())
+    {
+      written = false;
+      break;
+    }
+    buffer += encode_record(entry.id, entry.timestamp, false, entry.sender, entry.subject, content);
+    kept++;
+
+    if (buffer.size() >= COMPACT_BUFFER_SIZE)
+    {
+      written = write_all(fd, buffer);
+      buffer.clear();
+    }
+  }
+  written = written && write_all(fd, buffer) && (!sync || fdatasync(fd) == 0);
+  close(fd);
+  close(source_fd);
+
+  if (!written || rename(temp_path.c_str(), segment_path.c_str()) != 0)
+  {
+    LOG_ERROR("Unable to replace mailbox segment " << segment_path);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  if (sync && !sync_directory(segment_path.parent_path()))
+  {
+    LOG_ERROR("Unable to sync the rename of " << segment_path << ": " << std::strerror(errno));
+    view = MailboxView();
+    return false;
+  }
+
+  LOG_INFO("Compacted " << segment_path << ", dropped " << view.entries.size() - kept << " deleted records");
+  view = MailboxView(); // new file id, the next refresh reads the compacted file
+  return true;
+}
@@ -0,0 +1,71 @@
+#ifndef MAILBOX_SEGMENT_H
+#define MAILBOX_SEGMENT_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include "mailbox_index.h"
+
+namespace fs = std::filesystem;
+
+// Segment storage layout: all messages of an inbox in one append-only file
+// (<inbox>/mailbox.seg) instead of one file per message.
+//
+// After a 16 byte file header ("TWMS" + format version + random u64 file id)
+// the file is a sequence of length-prefixed records, each appended with a
+// single write():
+//
+//   u32 record length | u64 id | i64 timestamp | u8 deleted |
+//   u16 sender length | u16 subject length | u32 content length |
+//   sender | subject | content | u32 record length
+//
+// content is what the directory layout stores in the message file (receiver,
+// subject and message lines). The offset index is the MailboxView: refresh()
+// reads only the record headers appended since the last call and remembers
+// where each content starts, READ then needs a single pread().
+//
+// DEL appends a tombstone record for the id. The space of deleted messages is
+// reclaimed by compact(), which the server runs from a background thread. The
+// compacted file gets a new file id, that is how a cached view notices it.
+// A record cut short by a crash is ignored by refresh() and cut off by the
+// next append.
+//
+// Callers hold the inbox's MailboxLock: shared for refresh() and read(),
+// exclusive for changes.
+class MailboxSegment
+{
+public:
+    explicit MailboxSegment(const fs::path &user_inbox);
+
+    static bool exists(const fs::path &user_inbox);
+
+    // A missing segment is an empty inbox
+    bool refresh(MailboxView &view);
+
+    // Adds a message under id, which must be larger than view.max_id; sync:
+    // fdatasync() it (and the inbox directory for a new segment) before returning
+    bool append(MailboxView &view, uint64_t id, const std::string &sender, std::string_view subject, std::string_view content, int64_t timestamp, bool sync = false);
+
+    // content needs room for entry.content_length bytes
+    bool read(const IndexEntry &entry, char *content) const;
+
+    // Read-only descriptor of the segment file for sendfile(), -1 on error
+    int open_file() const;
+
+    bool remove(MailboxView &view, uint64_t id);
+
+    // True once deleted records waste enough of the file to be worth a rewrite
+    static bool needs_compaction(const MailboxView &view);
+
+    // Rewrites the segment with the live records only; sync: the new file and
+    // its rename are on disk before it returns, the segment is the only copy
+    bool compact(MailboxView &view, bool sync = false);
+
+private:
+    fs::path segment_path;
+
+    bool append_record(MailboxView &view, const std::string &record, bool sync = false);
+};
+
+#endif // MAILBOX_SEGMENT_H
@@ -0,0 +1,68 @@
+#include "memory_mail_store.h"
+#include <ctime>
+#include <functional>
+#include <mutex>
+
+MemoryMailStore::Shard &MemoryMailStore::shard_for(const std::string &user)
+{
+  return shards[std::hash<std::string>()(user) % SHARD_COUNT];
+}
+
+bool MemoryMailStore::append(const std::string &receiver, const std::string &sender, std::string_view subject, std::string_view content)
+{
+  Shard &shard = shard_for(receiver);
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+  Inbox &inbox = shard.inboxes[receiver];
+  uint64_t id = ++inbox.max_id;
+  Message &message = inbox.messages[id];
+  message.info = MessageInfo(id, std::time(nullptr), sender, subject);
+  message.content = std::string(content);
+  return true;
+}
+
+bool MemoryMailStore::list(const std::string &user, std::pmr::vector<MessageInfo> &messages)
+{
+  Shard &shard = shard_for(user);
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+  auto inbox = shard.inboxes.find(user);
+  if (inbox == shard.inboxes.end())
+  {
+    return true;
+  }
+  messages.reserve(inbox->second.messages.size());
+  for (const auto &message : inbox->second.messages)
+  {
+    messages.emplace_back(message.second.info);
+  }
+  return true;
+}
+
+bool MemoryMailStore::get(const std::string &user, uint64_t id, std::pmr::string &content)
+{
+  Shard &shard = shard_for(user);
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+  auto inbox = shard.inboxes.find(user);
+  if (inbox == shard.inboxes.end())
+  {
+    return false;
+  }
+  auto message = inbox->second.messages.find(id);
+  if (message == inbox->second.messages.end())
+  {
+    return false;
+  }
+  content.assign(message->second.content);
+  return true;
+}
+
+bool MemoryMailStore::remove(const std::string &user, uint64_t id)
+{
+  Shard &shard = shard_for(user);
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+  auto inbox = shard.inboxes.find(user);
+  return inbox != shard.inboxes.end() && inbox->second.messages.erase(id) > 0;
+}
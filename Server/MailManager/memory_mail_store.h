@@ -0,0 +1,49 @@
+#ifndef MEMORY_MAIL_STORE_H
+#define MEMORY_MAIL_STORE_H
+
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include "mail_store.h"
+
+// Keeps all inboxes in process memory and loses them on exit. Meant for
+// benchmarks: with no disk I/O left, what remains is protocol and network cost.
+//
+// Inboxes are spread over shards with their own reader/writer lock, so worker
+// threads rarely contend. Forked children each get their own copy, the backend is
+// therefore only useful with --reactor or --workers.
+class MemoryMailStore : public MailStore
+{
+public:
+    bool append(const std::string &receiver, const std::string &sender, std::string_view subject, std::string_view content) override;
+    bool list(const std::string &user, std::pmr::vector<MessageInfo> &messages) override;
+    bool get(const std::string &user, uint64_t id, std::pmr::string &content) override;
+    bool remove(const std::string &user, uint64_t id) override;
+
+private:
+    struct Message
+    {
+        MessageInfo info;
+        std::string content;
+    };
+
+    struct Inbox
+    {
+        uint64_t max_id = 0;
+        std::map<uint64_t, Message> messages; // id order for LIST
+    };
+
+    struct Shard
+    {
+        std::shared_mutex mutex;
+        std::unordered_map<std::string, Inbox> inboxes;
+    };
+
+    static constexpr size_t SHARD_COUNT = 64;
+    Shard shards[SHARD_COUNT];
+
+    Shard &shard_for(const std::string &user);
+};
+
+#endif // MEMORY_MAIL_STORE_H
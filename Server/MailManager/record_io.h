@@ -0,0 +1,109 @@
+#ifndef RECORD_IO_H
+#define RECORD_IO_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <ctime>
+#include <string>
+#include <sys/random.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Helpers for the binary mailbox files (index and segment). Integers are stored
+// in host byte order, the files never leave the machine that wrote them.
+
+template <typename T>
+inline void put(std::string &out, T value)
+{
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+inline T get(const char *data)
+{
+  T value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+inline bool write_all(int fd, const char *data, size_t length)
+{
+  size_t written = 0;
+  while (written < length)
+  {
+    ssize_t result = write(fd, data + written, length - written);
+    if (result < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    written += result;
+  }
+  return true;
+}
+
+inline bool write_all(int fd, const std::string &data)
+{
+  return write_all(fd, data.data(), data.size());
+}
+
+// fsync() of a directory, so entries created or renamed in it survive a crash
+inline bool sync_directory(const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  bool synced = fsync(fd) == 0;
+  close(fd);
+  return synced;
+}
+
+// syncfs() of the file system holding path: everything written to it so far,
+// data and directory entries, in one call
+inline bool sync_file_system(const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  bool synced = syncfs(fd) == 0;
+  close(fd);
+  return synced;
+}
+
+// pread() until length bytes arrived, returns the number of bytes read (short at end of file)
+inline size_t read_at(int fd, off_t offset, char *data, size_t length)
+{
+  size_t total = 0;
+  while (total < length)
+  {
+    ssize_t result = pread(fd, data + total, length - total, offset + total);
+    if (result <= 0)
+    {
+      if (result < 0 && errno == EINTR)
+        continue;
+      break;
+    }
+    total += result;
+  }
+  return total;
+}
+
+// Random id for a file header, never 0. A file rewritten and renamed into place
+// gets a new one, so a cached view notices the replacement even if the new file
+// reuses the inode (and by chance the size) of the old one.
+inline uint64_t new_file_id()
+{
+  uint64_t id = 0;
+  if (getrandom(&id, sizeof(id), 0) != sizeof(id))
+  {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    id = (static_cast<uint64_t>(now.tv_sec) << 32) ^ static_cast<uint64_t>(now.tv_nsec) ^ (static_cast<uint64_t>(getpid()) << 16);
+  }
+  return id != 0 ? id : 1;
+}
+
+#endif // RECORD_IO_H
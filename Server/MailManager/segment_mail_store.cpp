@@ -0,0 +1,151 @@
+#include "segment_mail_store.h"
+#include "mailbox_lock.h"
+#include "mailbox_segment.h"
+#include "record_io.h"
+#include <ctime>
+#include "../../utils/constants.h"
+
+SegmentMailStore::SegmentMailStore(const fs::path &mail_directory, Durability durability)
+: mail_directory(mail_directory)
+, durability(durability)
+{}
+
+bool SegmentMailStore::append(const std::string &receiver, const std::string &sender, std::string_view subject, std::string_view content)
+{
+  bool sync = durability == Durability::FsyncPerMessage;
+  fs::path receiver_inbox = mail_directory / receiver;
+  if (fs::create_directories(receiver_inbox) && sync && !sync_directory(mail_directory))
+  {
+    return false;
+  }
+  MailboxLock lock(receiver_inbox, MailboxLock::Mode::Exclusive);
+
+  // the whole message is one record appended to the receiver's segment; a
+  // record torn by a crash fails its length check and is never listed
+  MailboxSegment segment(receiver_inbox);
+  MailboxView &view = cached_view(receiver);
+  return lock.locked() && segment.refresh(view) &&
+         segment.append(view, view.max_id + 1, sender, subject, content, std::time(nullptr), sync);
+}
+
+bool SegmentMailStore::commit()
+{
+  return durability != Durability::GroupCommit || sync_file_system(mail_directory);
+}
+
+bool SegmentMailStore::list(const std::string &user, std::pmr::vector<MessageInfo> &messages)
+{
+  fs::path user_inbox = mail_directory / user;
+  if (!fs::is_directory(user_inbox))
+  {
+    return true;
+  }
+
+  // subjects come from the record headers, no content is read
+  MailboxLock lock(user_inbox, MailboxLock::Mode::Shared);
+  MailboxView &view = cached_view(user);
+  if (!lock.locked() || !MailboxSegment(user_inbox).refresh(view))
+  {
+    return false;
+  }
+
+  messages.reserve(view.live_count);
+  for (const auto &entry : view.entries)
+  {
+    if (!entry.deleted)
+    {
+      messages.emplace_back(entry.id, entry.timestamp, entry.sender, entry.subject);
+    }
+  }
+  return true;
+}
+
+bool SegmentMailStore::get(const std::string &user, uint64_t id, std::pmr::string &content)
+{
+  fs::path user_inbox = mail_directory / user;
+  if (!fs::is_directory(user_inbox))
+  {
+    return false;
+  }
+
+  MailboxLock lock(user_inbox, MailboxLock::Mode::Shared);
+  MailboxSegment segment(user_inbox);
+  MailboxView &view = cached_view(user);
+  const IndexEntry *entry = lock.locked() && segment.refresh(view) ? view.find(id) : nullptr;
+  if (entry == nullptr)
+  {
+    return false;
+  }
+  content.resize(entry->content_length);
+  return segment.read(*entry, &content[0]);
+}
+
+bool SegmentMailStore::open(const std::string &user, uint64_t id, MessageFile &file)
+{
+  fs::path user_inbox = mail_directory / user;
+  if (!fs::is_directory(user_inbox))
+  {
+    return false;
+  }
+
+  // a compaction after the lock is released renames a new segment into place,
+  // the open descriptor still refers to the old one and its offsets
+  MailboxLock lock(user_inbox, MailboxLock::Mode::Shared);
+  MailboxSegment segment(user_inbox);
+  MailboxView &view = cached_view(user);
+  const IndexEntry *entry = lock.locked() && segment.refresh(view) ? view.find(id) : nullptr;
+  if (entry == nullptr)
+  {
+    return false;
+  }
+
+  file.fd = segment.open_file();
+  file.offset = entry->content_offset;
+  file.length = entry->content_length;
+  return file.fd != -1;
+}
+
+bool SegmentMailStore::remove(const std::string &user, uint64_t id)
+{
+  fs::path user_inbox = mail_directory / user;
+  if (!fs::is_directory(user_inbox))
+  {
+    return false;
+  }
+
+  // only a tombstone is appended, maintain() reclaims the space
+  MailboxLock lock(user_inbox, MailboxLock::Mode::Exclusive);
+  MailboxSegment segment(user_inbox);
+  MailboxView &view = cached_view(user);
+  return lock.locked() && segment.refresh(view) && segment.remove(view, id);
+}
+
+void SegmentMailStore::maintain()
+{
+  std::error_code error;
+  for (const auto &dir_entry : fs::directory_iterator(mail_directory, error))
+  {
+    std::string user = dir_entry.path().filename().string();
+    if (!dir_entry.is_directory() || user[0] == '.' || !MailboxSegment::exists(dir_entry.path()))
+      continue;
+
+    MailboxSegment segment(dir_entry.path());
+    if (compactor_views.size() >= ServerConstants::MAX_CACHED_MAILBOXES && compactor_views.find(user) == compactor_views.end())
+    {
+      compactor_views.clear(); // like cached_view(): the views are rebuilt from the segments
+    }
+    MailboxView &view = compactor_views[user];
+    {
+      // checking is cheap and does not block readers
+      MailboxLock lock(dir_entry.path(), MailboxLock::Mode::Shared);
+      if (!lock.locked() || !segment.refresh(view) || !MailboxSegment::needs_compaction(view))
+        continue;
+    }
+
+    MailboxLock lock(dir_entry.path(), MailboxLock::Mode::Exclusive);
+    if (lock.locked() && segment.refresh(view) && MailboxSegment::needs_compaction(view))
+    {
+      segment.compact(view, durability != Durability::None);
+    }
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef SEGMENT_MAIL_STORE_H
+#define SEGMENT_MAIL_STORE_H
+
+#include <string>
+#include <unordered_map>
+#include "mail_store.h"
+#include "mailbox_index.h"
+
+// One append-only MailboxSegment per inbox: <spool>/<user>/mailbox.seg.
+// DEL only appends tombstones, maintain() reclaims their space.
+class SegmentMailStore : public MailStore
+{
+public:
+    SegmentMailStore(const fs::path &mail_directory, Durability durability);
+
+    bool append(const std::string &receiver, const std::string &sender, std::string_view subject, std::string_view content) override;
+    bool list(const std::string &user, std::pmr::vector<MessageInfo> &messages) override;
+    bool get(const std::string &user, uint64_t id, std::pmr::string &content) override;
+    bool remove(const std::string &user, uint64_t id) override;
+    bool commit() override;
+
+    bool can_open() const override { return true; }
+    bool open(const std::string &user, uint64_t id, MessageFile &file) override;
+
+    bool needs_maintenance() const override { return true; }
+    // compacts every segment where deleted records waste enough space
+    void maintain() override;
+
+private:
+    fs::path mail_directory;
+    Durability durability;
+
+    // views of the maintenance thread, kept across runs so an unchanged segment costs only an fstat() and a header read
+    // at most MAX_CACHED_MAILBOXES, the map starts over when a new mailbox would exceed it
+    std::unordered_map<std::string, MailboxView> compactor_views;
+};
+
+#endif // SEGMENT_MAIL_STORE_H
@@ -0,0 +1,113 @@
+#include "admission_control.h"
+#include <algorithm>
+
+AdmissionControl::AdmissionControl(const AdmissionConfig &config)
+: config(config)
+{}
+
+void AdmissionControl::refill(Source &source, std::chrono::steady_clock::time_point now) const
+{
+  std::chrono::duration<double> elapsed = now - source.refilled;
+  source.tokens = std::min(config.ip_burst, source.tokens + elapsed.count() * config.ip_rate);
+  source.refilled = now;
+}
+
+// Idle sources with a full bucket behave like unknown ones. Only the least
+// recently used end is looked at, so each call is O(1) amortized: every
+// source is dropped at most once after it was added.
+void AdmissionControl::forget_idle(std::chrono::steady_clock::time_point now)
+{
+  while (!idle.empty())
+  {
+    auto oldest = sources.find(idle.front());
+    refill(oldest->second, now);
+    if (oldest->second.tokens < config.ip_burst)
+      break;
+    idle.pop_front();
+    sources.erase(oldest);
+  }
+}
+
+// The source of ip, added as the most recently used idle one if unknown.
+// nullptr if the table is full of sources with open connections.
+AdmissionControl::Source *AdmissionControl::track(uint32_t ip, std::chrono::steady_clock::time_point now)
+{
+  auto known = sources.find(ip);
+  if (known != sources.end())
+  {
+    Source &source = known->second;
+    if (config.ip_rate > 0)
+    {
+      refill(source, now);
+    }
+    if (source.open == 0)
+    {
+      idle.splice(idle.end(), idle, source.idle_position);
+    }
+    return &source;
+  }
+
+  if (sources.size() >= ServerConstants::MAX_TRACKED_SOURCES)
+  {
+    if (idle.empty())
+      return nullptr;
+    // the oldest loses its (partly refilled) bucket, as if it was never seen
+    sources.erase(idle.front());
+    idle.pop_front();
+  }
+
+  Source &source = sources.emplace(ip, Source{config.ip_burst, now, 0, {}}).first->second;
+  source.idle_position = idle.insert(idle.end(), ip);
+  return &source;
+}
+
+bool AdmissionControl::admit(uint32_t ip)
+{
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (open >= config.max_connections)
+  {
+    rejected_count++;
+    return false;
+  }
+
+  forget_idle(now);
+  Source *source = track(ip, now);
+  if (source == nullptr || source->open >= config.max_per_ip || (config.ip_rate > 0 && source->tokens < 1))
+  {
+    rejected_count++;
+    return false;
+  }
+
+  if (config.ip_rate > 0)
+  {
+    source->tokens -= 1;
+  }
+  if (source->open++ == 0)
+  {
+    idle.erase(source->idle_position);
+  }
+  open++;
+  return true;
+}
+
+void AdmissionControl::release(uint32_t ip)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  auto source = sources.find(ip);
+  if (source != sources.end() && source->second.open > 0 && --source->second.open == 0)
+  {
+    source->second.idle_position = idle.insert(idle.end(), ip);
+  }
+  if (open > 0)
+  {
+    open--;
+  }
+}
+
+unsigned long AdmissionControl::rejected() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return rejected_count;
+}
@@ -0,0 +1,63 @@
+#ifndef ADMISSION_CONTROL_H
+#define ADMISSION_CONTROL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "../utils/constants.h"
+
+struct AdmissionConfig
+{
+    size_t max_connections = ServerConstants::MAX_CONNECTIONS;    // open at once, all clients
+    size_t max_per_ip = ServerConstants::MAX_CONNECTIONS_PER_IP;  // open at once, one source IP
+    double ip_rate = ServerConstants::IP_CONNECT_RATE;            // new connections per sec and IP, 0: unlimited
+    double ip_burst = ServerConstants::IP_CONNECT_BURST;          // bucket size
+};
+
+// Decides right after accept() whether a connection is served at all, before a
+// child is forked or a Connection allocated. Each source IP has a token bucket
+// for new connections and a count of open ones; a global count caps the total.
+//
+// At most MAX_TRACKED_SOURCES IPs are tracked. Those without open connections
+// are kept in least recently used order: once their bucket is full again they
+// are forgotten from the old end, and a full table evicts the oldest one. Both
+// cost O(1) amortized per admit(), the table is never scanned.
+//
+// Lives in the accepting process only: the fork loop's parent or the reactor
+// threads, which share one instance (thread-safe).
+class AdmissionControl
+{
+public:
+    explicit AdmissionControl(const AdmissionConfig &config = AdmissionConfig());
+
+    // IPv4 address in network byte order. true: counted as open until release()
+    bool admit(uint32_t ip);
+    void release(uint32_t ip);
+
+    unsigned long rejected() const;
+
+private:
+    struct Source
+    {
+        double tokens;
+        std::chrono::steady_clock::time_point refilled;
+        size_t open = 0;
+        std::list<uint32_t>::iterator idle_position; // valid while open == 0
+    };
+
+    AdmissionConfig config;
+    mutable std::mutex mutex;
+    std::unordered_map<uint32_t, Source> sources;
+    std::list<uint32_t> idle; // sources without open connections, least recently used first
+    size_t open = 0;
+    unsigned long rejected_count = 0;
+
+    void refill(Source &source, std::chrono::steady_clock::time_point now) const;
+    void forget_idle(std::chrono::steady_clock::time_point now);
+    Source *track(uint32_t ip, std::chrono::steady_clock::time_point now);
+};
+
+#endif // ADMISSION_CONTROL_H
@@ -0,0 +1,45 @@
+#include "allocation_counter.h"
+#include <cstdlib>
+#include <new>
+
+// constant initialized, so counting works from the very first allocation of a thread
+static thread_local uint64_t allocations = 0;
+
+uint64_t AllocationCounter::thread_allocations()
+{
+  return allocations;
+}
+
+// The array, nothrow and sized forms of the standard library forward to these
+void *operator new(size_t size)
+{
+  allocations++;
+  if (size == 0)
+  {
+    size = 1;
+  }
+  while (true)
+  {
+    void *memory = std::malloc(size);
+    if (memory != nullptr)
+    {
+      return memory;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr)
+    {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void operator delete(void *memory) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+  std::free(memory);
+}
@@ -0,0 +1,17 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+// The server replaces the global operator new with one that counts the calls
+// of each thread. The request path takes its temporaries from the connection's
+// RequestArena and is meant to stay off the heap; the difference of two
+// readings around a request shows whether it does, the metrics export it per
+// command.
+namespace AllocationCounter
+{
+    // operator new calls of the calling thread since it started
+    uint64_t thread_allocations();
+}
+
+#endif // ALLOCATION_COUNTER_H
@@ -0,0 +1,85 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "../utils/frame_parser.h"
+#include "../utils/output_queue.h"
+#include "../utils/request_arena.h"
+#include "Auth/authenticator.h"
+
+struct Connection;
+
+// What an epoll registration in reactor mode belongs to. The listening socket
+// is registered with a null pointer.
+struct EventSource
+{
+    enum class Kind { Client, Auth };
+    Kind kind;
+    Connection *conn;
+};
+
+// A LOGIN whose credential check has not been answered yet. The frames behind
+// it wait, so replies keep the order of the requests.
+struct PendingLogin
+{
+    enum class State { None, Waiting, Checking };
+
+    State state = State::None;
+    std::string username;
+    std::string password;
+    bool retried = false;                  // a lost backend connection is retried once
+    bool cache_checked = false;            // the AuthCache was asked before the backend
+    bool cache_lookup = false;             // attempt is an AuthCache lookup, not a backend check
+    std::unique_ptr<AuthAttempt> attempt;  // set while Checking
+    int watched_fd = -1;                   // reactor: attempt's descriptor registered with epoll
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::steady_clock::time_point started;       // LOGIN dispatched, unset while answered right away
+    std::chrono::steady_clock::time_point check_started; // for the authentication latency
+};
+
+// Per-client state that used to live in the forked child's copy of Server.
+// One object per accepted socket, shared by the fork and the reactor mode.
+struct Connection
+{
+    int consfd = -1;
+    std::string client_addr_ip;
+    uint32_t client_ip = 0; // network byte order, as admitted by AdmissionControl
+
+    bool logged_in = false;
+    std::string authenticated_user;
+    int attempted_logins_cnt = 0;
+
+    PendingLogin login;
+
+    FrameParser parser;      // bytes received but not yet dispatched
+    OutputQueue send_buffer; // replies not yet written to the socket
+    RequestArena arena;      // temporaries of the request being dispatched
+
+    // reactor mode only
+    EventSource client_source{EventSource::Kind::Client, this};
+    EventSource auth_source{EventSource::Kind::Auth, this};
+    bool closed = false; // closed in the current epoll batch, freed after it
+
+    // group commit: SENDs whose OK is queued but must wait for the next sync
+    int uncommitted_sends = 0;
+    bool commit_queued = false; // in the worker's commit_waiters
+
+    // io_uring mode only. Operations in flight point into the connection, so it
+    // is freed only once the last of them completed.
+    int inflight = 0;
+    bool receiving = false;
+    bool sending = false;   // nothing is dispatched meanwhile, the iovecs point into send_buffer
+    bool closing = false;   // QUIT or a broken frame: closed once the replies are out
+    struct msghdr send_message = {};
+    struct iovec send_iov[OutputQueue::MAX_GATHER];
+    std::chrono::steady_clock::time_point send_started;
+
+    bool login_pending() const { return login.state != PendingLogin::State::None; }
+};
+
+#endif // CONNECTION_H
@@ -0,0 +1,294 @@
+#include "metrics.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../utils/constants.h"
+#include "../utils/log.h"
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "metrics are shared between processes");
+
+static const char *COMMAND_NAMES[] = {"LOGIN", "SEND", "LIST", "READ", "DEL", "QUIT"};
+static const char *COMMAND_LABELS[] = {"login", "send", "list", "read", "del", "quit"};
+
+static uint64_t to_micros(std::chrono::steady_clock::duration elapsed)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t micros)
+{
+  constexpr uint64_t sub_buckets = 1 << SUB_BUCKET_BITS;
+  if (micros < sub_buckets)
+  {
+    return micros;
+  }
+  int exponent = 63 - __builtin_clzll(micros);
+  if (exponent > MAX_EXPONENT)
+  {
+    return BUCKET_COUNT - 1;
+  }
+  // the top SUB_BUCKET_BITS bits below the leading one pick the sub-bucket
+  return ((exponent - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + (micros >> (exponent - SUB_BUCKET_BITS)) - sub_buckets;
+}
+
+uint64_t LatencyHistogram::bucket_limit(size_t bucket)
+{
+  constexpr uint64_t sub_buckets = 1 << SUB_BUCKET_BITS;
+  if (bucket < sub_buckets)
+  {
+    return bucket;
+  }
+  int shift = (bucket >> SUB_BUCKET_BITS) - 1;
+  uint64_t low = (sub_buckets + (bucket & (sub_buckets - 1))) << shift;
+  return low + (uint64_t(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t micros)
+{
+  buckets[bucket_of(micros)].fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(micros, std::memory_order_relaxed);
+}
+
+Metrics::Metrics()
+{
+  // shared before the first fork, so every handler counts into the same histograms
+  void *memory = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+  {
+    throw std::runtime_error("Unable to map the metrics: " + std::to_string(errno));
+  }
+  shared = new (memory) Shared();
+}
+
+Metrics::~Metrics()
+{
+  munmap(shared, sizeof(Shared));
+}
+
+MetricCommand Metrics::command_of(std::string_view command)
+{
+  for (size_t i = 0; i < COMMAND_COUNT; i++)
+  {
+    if (command == COMMAND_NAMES[i])
+    {
+      return static_cast<MetricCommand>(i);
+    }
+  }
+  return MetricCommand::Count;
+}
+
+void Metrics::observe_request(MetricCommand command, std::chrono::steady_clock::duration elapsed)
+{
+  if (command != MetricCommand::Count)
+  {
+    shared->requests[static_cast<size_t>(command)].record(to_micros(elapsed));
+  }
+}
+
+void Metrics::observe_storage(MetricCommand command, std::chrono::steady_clock::duration elapsed)
+{
+  if (command != MetricCommand::Count)
+  {
+    shared->storage[static_cast<size_t>(command)].record(to_micros(elapsed));
+  }
+}
+
+void Metrics::observe_auth(std::chrono::steady_clock::duration elapsed)
+{
+  shared->auth.record(to_micros(elapsed));
+}
+
+void Metrics::observe_commit(std::chrono::steady_clock::duration elapsed, size_t sends)
+{
+  shared->commits.record(to_micros(elapsed));
+  shared->committed_sends.fetch_add(sends, std::memory_order_relaxed);
+}
+
+void Metrics::observe_socket_write(std::chrono::steady_clock::duration elapsed, size_t bytes)
+{
+  shared->socket_writes.record(to_micros(elapsed));
+  shared->bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Metrics::observe_allocations(MetricCommand command, uint64_t allocations)
+{
+  if (command != MetricCommand::Count)
+  {
+    shared->allocations[static_cast<size_t>(command)].fetch_add(allocations, std::memory_order_relaxed);
+  }
+}
+
+void Metrics::count_connection(bool admitted)
+{
+  (admitted ? shared->connections_accepted : shared->connections_rejected).fetch_add(1, std::memory_order_relaxed);
+}
+
+static void render_header(std::string &out, const char *name, const char *type, const char *help)
+{
+  out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void Metrics::append_counter(std::string &out, const char *name, const char *help, uint64_t value)
+{
+  render_header(out, name, "counter", help);
+  out.append(name).append(" ").append(std::to_string(value)).append("\n");
+}
+
+// Cumulative buckets in seconds. The counters are read one by one while others
+// keep recording; the total is summed from the same reads so +Inf and _count
+// always agree with the buckets.
+static uint64_t render_histogram(std::string &out, const char *name, const std::string &labels, const LatencyHistogram &histogram)
+{
+  std::string prefix = labels.empty() ? "{" : "{" + labels + ",";
+  char number[32];
+  uint64_t count = 0;
+  for (size_t bucket = 0; bucket < LatencyHistogram::BUCKET_COUNT; bucket++)
+  {
+    count += histogram.buckets[bucket].load(std::memory_order_relaxed);
+    // the last bucket also holds everything beyond the range, only +Inf describes it
+    if (bucket + 1 < LatencyHistogram::BUCKET_COUNT)
+    {
+      snprintf(number, sizeof(number), "%.6f", LatencyHistogram::bucket_limit(bucket) / 1e6);
+      out.append(name).append("_bucket").append(prefix).append("le=\"").append(number).append("\"} ").append(std::to_string(count)).append("\n");
+    }
+  }
+  out.append(name).append("_bucket").append(prefix).append("le=\"+Inf\"} ").append(std::to_string(count)).append("\n");
+
+  std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+  snprintf(number, sizeof(number), "%.6f", histogram.sum.load(std::memory_order_relaxed) / 1e6);
+  out.append(name).append("_sum").append(suffix).append(" ").append(number).append("\n");
+  out.append(name).append("_count").append(suffix).append(" ").append(std::to_string(count)).append("\n");
+  return count;
+}
+
+std::string Metrics::render() const
+{
+  std::string out;
+  uint64_t handled[COMMAND_COUNT];
+
+  render_header(out, "twmailer_request_duration_seconds", "histogram", "Time from a complete request to its queued reply.");
+  for (size_t i = 0; i < COMMAND_COUNT; i++)
+  {
+    handled[i] = render_histogram(out, "twmailer_request_duration_seconds", std::string("command=\"") + COMMAND_LABELS[i] + "\"", shared->requests[i]);
+  }
+
+  render_header(out, "twmailer_requests_total", "counter", "Requests handled, by command.");
+  for (size_t i = 0; i < COMMAND_COUNT; i++)
+  {
+    out.append("twmailer_requests_total{command=\"").append(COMMAND_LABELS[i]).append("\"} ").append(std::to_string(handled[i])).append("\n");
+  }
+
+  render_header(out, "twmailer_request_heap_allocations_total", "counter", "Heap allocations while dispatching requests, by command.");
+  for (size_t i = 0; i < COMMAND_COUNT; i++)
+  {
+    out.append("twmailer_request_heap_allocations_total{command=\"").append(COMMAND_LABELS[i]).append("\"} ")
+       .append(std::to_string(shared->allocations[i].load(std::memory_order_relaxed))).append("\n");
+  }
+
+  render_header(out, "twmailer_storage_duration_seconds", "histogram", "Time spent in the mail store, by command.");
+  for (MetricCommand command : {MetricCommand::Send, MetricCommand::List, MetricCommand::Read, MetricCommand::Del})
+  {
+    size_t i = static_cast<size_t>(command);
+    render_histogram(out, "twmailer_storage_duration_seconds", std::string("command=\"") + COMMAND_LABELS[i] + "\"", shared->storage[i]);
+  }
+
+  render_header(out, "twmailer_auth_duration_seconds", "histogram", "Time until the authentication backend answered a credential check.");
+  render_histogram(out, "twmailer_auth_duration_seconds", "", shared->auth);
+
+  render_header(out, "twmailer_commit_duration_seconds", "histogram", "Time of each group commit sync.");
+  render_histogram(out, "twmailer_commit_duration_seconds", "", shared->commits);
+  append_counter(out, "twmailer_committed_sends_total", "SENDs made durable by group commits.", shared->committed_sends.load(std::memory_order_relaxed));
+
+  render_header(out, "twmailer_socket_write_duration_seconds", "histogram", "Time spent writing queued replies to a client socket.");
+  render_histogram(out, "twmailer_socket_write_duration_seconds", "", shared->socket_writes);
+
+  append_counter(out, "twmailer_socket_written_bytes_total", "Reply bytes written to client sockets.", shared->bytes_written.load(std::memory_order_relaxed));
+  append_counter(out, "twmailer_connections_accepted_total", "Connections admitted after accept.", shared->connections_accepted.load(std::memory_order_relaxed));
+  append_counter(out, "twmailer_connections_rejected_total", "Connections closed by admission control.", shared->connections_rejected.load(std::memory_order_relaxed));
+  return out;
+}
+
+MetricsEndpoint::MetricsEndpoint(int port, std::function<std::string()> render)
+: render(std::move(render))
+{
+  listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1)
+  {
+    throw std::runtime_error("Error initializing the metrics socket: " + std::to_string(errno));
+  }
+
+  int enable = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+
+  // admin traffic only, never reachable from outside the host
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listen_fd, ServerConstants::MAX_PENDING_CONNECTIONS) == -1)
+  {
+    close(listen_fd);
+    throw std::runtime_error("Unable to listen for metrics scrapes on port " + std::to_string(port) + ": " + std::to_string(errno));
+  }
+  LOG_INFO("Metrics on http://127.0.0.1:" << port << "/metrics");
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+  close(listen_fd);
+}
+
+void MetricsEndpoint::run()
+{
+  while (true)
+  {
+    int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client_fd == -1)
+    {
+      continue;
+    }
+    answer(client_fd);
+    close(client_fd);
+  }
+}
+
+void MetricsEndpoint::answer(int client_fd)
+{
+  // a stuck scraper must not block the next one for long
+  struct timeval timeout = {ServerConstants::METRICS_SCRAPE_TIMEOUT, 0};
+  setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // the request itself does not matter, only wait until its header is complete
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos && request.size() < sizeof(buffer) * 8)
+  {
+    ssize_t received = recv(client_fd, buffer, sizeof(buffer), 0);
+    if (received <= 0)
+    {
+      return;
+    }
+    request.append(buffer, received);
+  }
+
+  std::string body = render();
+  std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) +
+                         "\r\nConnection: close\r\n\r\n" + body;
+  size_t sent = 0;
+  while (sent < response.size())
+  {
+    ssize_t result = send(client_fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if (result <= 0)
+    {
+      return;
+    }
+    sent += result;
+  }
+}
@@ -0,0 +1,119 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Commands with their own series, in the order of their labels
+enum class MetricCommand { Login, Send, List, Read, Del, Quit, Count };
+
+// Latencies in whole microseconds, bucketed HDR style: 4 linear sub-buckets per
+// power of two, so every bucket is at most 25 % wide and the whole range up to
+// about a minute fits in 100 counters. Lock-free, any number of processes and
+// threads record concurrently.
+struct LatencyHistogram
+{
+    static constexpr int SUB_BUCKET_BITS = 2;
+    static constexpr int MAX_EXPONENT = 25; // 2^26 us, larger values land in the last bucket
+    static constexpr size_t BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) << SUB_BUCKET_BITS;
+
+    std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> sum; // in us
+
+    void record(uint64_t micros);
+
+    static size_t bucket_of(uint64_t micros);
+    // Largest value counted in bucket, in us
+    static uint64_t bucket_limit(size_t bucket);
+};
+
+// Request counters and latency histograms of the whole server. Like the
+// authentication cache they live in anonymous shared memory mapped before the
+// first fork, so forked handlers, reactor workers and the endpoint all see the
+// same numbers.
+//
+// What is measured:
+// - request: from the complete frame to its queued reply, LOGIN includes the
+//   wait for the authentication backend
+// - storage: the mail store part of SEND/LIST/READ/DEL
+// - auth: answered credential checks, from start to answer
+// - commit: each group commit sync, and how many SENDs shared it
+// - socket write: each flush of queued replies to a client
+// - heap allocations: operator new calls while a request was dispatched,
+//   zero for a connection in steady state except where the store allocates
+class Metrics
+{
+public:
+    Metrics();
+    ~Metrics();
+
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+
+    // Count for unknown commands
+    static MetricCommand command_of(std::string_view command);
+
+    void observe_request(MetricCommand command, std::chrono::steady_clock::duration elapsed);
+    void observe_storage(MetricCommand command, std::chrono::steady_clock::duration elapsed);
+    void observe_auth(std::chrono::steady_clock::duration elapsed);
+    // One group commit and the number of SENDs it made durable
+    void observe_commit(std::chrono::steady_clock::duration elapsed, size_t sends);
+    void observe_socket_write(std::chrono::steady_clock::duration elapsed, size_t bytes);
+    // Heap allocations made while dispatching one request, see AllocationCounter
+    void observe_allocations(MetricCommand command, uint64_t allocations);
+    void count_connection(bool admitted);
+
+    // Prometheus text exposition format
+    std::string render() const;
+
+    // For counters kept elsewhere, e.g. by the authentication cache
+    static void append_counter(std::string &out, const char *name, const char *help, uint64_t value);
+
+private:
+    static constexpr size_t COMMAND_COUNT = static_cast<size_t>(MetricCommand::Count);
+
+    struct Shared
+    {
+        LatencyHistogram requests[COMMAND_COUNT];
+        LatencyHistogram storage[COMMAND_COUNT];
+        LatencyHistogram auth;
+        LatencyHistogram commits;
+        std::atomic<uint64_t> committed_sends;
+        LatencyHistogram socket_writes;
+        std::atomic<uint64_t> bytes_written;
+        std::atomic<uint64_t> allocations[COMMAND_COUNT];
+        std::atomic<uint64_t> connections_accepted;
+        std::atomic<uint64_t> connections_rejected;
+    };
+
+    Shared *shared = nullptr;
+};
+
+// Serves the metrics over HTTP on a separate port, bound to the loopback
+// interface only. Every request gets the current text, whatever its path.
+class MetricsEndpoint
+{
+public:
+    // Listens right away, throws if the port is taken
+    MetricsEndpoint(int port, std::function<std::string()> render);
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const MetricsEndpoint &) = delete;
+    MetricsEndpoint &operator=(const MetricsEndpoint &) = delete;
+
+    // Answers scrapes one after another, never returns
+    void run();
+
+private:
+    int listen_fd = -1;
+    std::function<std::string()> render;
+
+    void answer(int client_fd);
+};
+
+#endif // METRICS_H
@@ -1,61 +1,202 @@
 #include "server.h"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <ctime>
 #include <fstream>
-#include <iostream>
+#include <poll.h>
 #include <signal.h>
 #include <sstream>
 #include <stdexcept>
+#include <unordered_map>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <unistd.h>
-#include <ldap.h>
-#include <lber.h>
+#include "allocation_counter.h"
+#include "uring.h"
 #include "../utils/helpers.h"
 #include "../utils/constants.h"
+#include "../utils/log.h"
 
-Server::Server(int port, const fs::path &mailDirectory)
+Server::Server(int port, const fs::path &mailDirectory, const ServerConfig &config)
 : port(port)
-, mail_manager(mailDirectory)
+, socket_fd(-1)
+, config(config)
+, mail_store(create_mail_store(config.storage_layout, mailDirectory, config.durability))
+, mail_manager(*mail_store)
 , blacklist()
-, mail_sem() // Semaphore for mail access
-, blacklist_sem() // Semaphore for blacklist access
+, admission(config.admission)
+, authenticator(create_authenticator(config.auth))
+, auth_cache(config.auth_cache)
 {
-  attempted_logins_cnt = 0;
-  init_socket();
-
-  // Initialize semaphores
-  if (sem_init(&mail_sem, 1, 1) != 0)
+  if (config.workers > 0)
+  {
+    // every worker gets its own SO_REUSEPORT socket so the kernel spreads accepts across them
+    for (int i = 0; i < config.workers; i++)
+    {
+      std::unique_ptr<Worker> worker(new Worker());
+      worker->id = i;
+      worker->listen_fd = init_socket(true);
+      workers.push_back(std::move(worker));
+    }
+  }
+  else
   {
-    std::cout << "Semaphore initialization failed for mail_sem." << std::endl;
-    exit(EXIT_FAILURE);
+    socket_fd = init_socket(false);
   }
-  if (sem_init(&blacklist_sem, 1, 1) != 0)
+
+  // entries of the last snapshot that have not expired yet
+  blacklist.load_snapshot();
+
+  if (config.metrics_port > 0)
   {
-    std::cout << "Semaphore initialization failed for blacklist_sem." << std::endl;
-    exit(EXIT_FAILURE);
+    metrics_endpoint.reset(new MetricsEndpoint(config.metrics_port, [this]()
+    {
+      std::string text = metrics.render();
+      Metrics::append_counter(text, "twmailer_auth_cache_hits_total", "Logins answered by the authentication cache.", auth_cache.hits());
+      Metrics::append_counter(text, "twmailer_auth_cache_misses_total", "Logins passed on to the authentication backend.", auth_cache.misses());
+      return text;
+    }));
   }
 }
 
 Server::~Server()
 {
-  close(socket_fd);
+  if (socket_fd != -1)
+  {
+    close(socket_fd);
+  }
+  for (auto &worker : workers)
+  {
+    close(worker->listen_fd);
+  }
+}
+
+// Lift the soft fd limit to the hard limit, idle clients each hold one descriptor
+static void raise_fd_limit()
+{
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+  {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
 }
 
 void Server::run()
 {
-  listen_for_connections();
+  if (mail_store->needs_maintenance())
+  {
+    start_store_maintenance();
+  }
+  start_blacklist_maintenance();
+  if (metrics_endpoint)
+  {
+    start_metrics_endpoint();
+  }
+
+  std::string reason;
+  if (config.use_io_uring && !IoUring::supported(reason))
+  {
+    LOG_WARNING("io_uring unavailable, falling back to epoll: " << reason);
+    config.use_io_uring = false;
+  }
+
+  if (config.workers > 0 || config.use_reactor)
+  {
+    raise_fd_limit(); // every client of the event loops stays in this process
+  }
+
+  if (config.workers > 0)
+  {
+    run_workers();
+  }
+  else if (config.use_reactor)
+  {
+    Worker worker;
+    worker.listen_fd = socket_fd;
+    config.use_io_uring ? run_uring_loop(worker) : run_event_loop(worker);
+  }
+  else
+  {
+    listen_for_connections();
+  }
+}
+
+// Housekeeping of the mail store, e.g. the segment layout only leaves tombstones
+// on DEL and this thread reclaims their space while the server keeps serving.
+void Server::start_store_maintenance()
+{
+  std::thread([this]()
+  {
+    while (true)
+    {
+      sleep(ServerConstants::STORE_MAINTENANCE_INTERVAL);
+      try
+      {
+        mail_store->maintain();
+      }
+      catch (const std::exception &e)
+      {
+        LOG_ERROR("Mail store maintenance failed: " << e.what());
+      }
+    }
+  }).detach();
 }
 
-void Server::init_socket()
+// Frees expired blacklist entries off the accept path. The blacklist lives in
+// shared memory only, with snapshots enabled this thread also persists it so a
+// restart does not unblock every IP.
+void Server::start_blacklist_maintenance()
+{
+  std::thread([this]()
+  {
+    unsigned int interval = ServerConstants::BLACKLIST_CLEANUP_INTERVAL;
+    if (config.blacklist_snapshot > 0)
+    {
+      interval = std::min<unsigned int>(interval, config.blacklist_snapshot);
+    }
+
+    time_t last_snapshot = std::time(nullptr);
+    while (true)
+    {
+      sleep(interval);
+      blacklist.cleanUp();
+      if (config.blacklist_snapshot > 0 && std::time(nullptr) - last_snapshot >= config.blacklist_snapshot)
+      {
+        blacklist.save_snapshot();
+        last_snapshot = std::time(nullptr);
+      }
+    }
+  }).detach();
+}
+
+// Answers metrics scrapes off the serving path. In fork mode this thread stays
+// in the parent, the children record into the shared histograms.
+void Server::start_metrics_endpoint()
+{
+  MetricsEndpoint *endpoint = metrics_endpoint.get();
+  std::thread([endpoint]()
+  {
+    endpoint->run();
+  }).detach();
+}
+
+// Creates a bound, listening socket. With reuse_port several sockets can be bound
+// to the same port and the kernel load-balances incoming connections between them.
+int Server::init_socket(bool reuse_port)
 {
   // AF_INET (IPv4), SOCK_STREAM (typically TCP), 0 (default protocol)
-  socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (socket_fd == -1)
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd == -1)
   {
     throw std::runtime_error("Error initializing the server socket: " + std::to_string(errno));
   }
 
-  std::cout << "Socket was created with id " << socket_fd << "\n";
+  LOG_DEBUG("Socket was created with id " << listen_fd);
 
   // set up server address struct to bind socket to a specific address
   struct sockaddr_in serveraddr;
@@ -66,31 +207,38 @@ void Server::init_socket()
   // set socket options (SO_REUSEADDRE - reusing local address and same port
   // even if in TIME_WAIT)
   int enable = 1;
-  if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) == -1)
+  if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) == -1)
   {
     throw std::runtime_error("Unable to set socket options due to: " + std::to_string(errno));
   }
+  if (reuse_port && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) == -1)
+  {
+    throw std::runtime_error("Unable to set SO_REUSEPORT due to: " + std::to_string(errno));
+  }
 
   // binds the socket with a specific address
-  if (bind(socket_fd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) == -1)
+  if (bind(listen_fd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) == -1)
   {
     throw std::runtime_error("Binding failed with error: " + std::to_string(errno));
   }
 
   // socket starts listening for connection requests
-  if (listen(socket_fd, ServerConstants::MAX_PENDING_CONNECTIONS) == -1)
+  // the reactor accepts in bursts, so it gets the full kernel backlog
+  int backlog = (config.use_reactor || config.workers > 0) ? SOMAXCONN : ServerConstants::MAX_PENDING_CONNECTIONS;
+  if (listen(listen_fd, backlog) == -1)
   {
     throw std::runtime_error("Unable to establish connection: " + std::to_string(errno));
   }
+
+  return listen_fd;
 }
 
 void Server::listen_for_connections()
 {
   int pid_t;
 
-  // Automatically clean up child processes
-  // Parent process doesnt check exit status, Kernel reclaims ressources
-  signal(SIGCHLD, SIG_IGN);
+  // children are reaped below, so their connections can be released from the admission counts
+  std::unordered_map<int, uint32_t> children;
 
   struct sockaddr_in client_addr;
   socklen_t addrlen = sizeof(client_addr);
@@ -100,30 +248,54 @@ void Server::listen_for_connections()
     int peersoc = accept(socket_fd, (struct sockaddr *)&client_addr, &addrlen);
     if (peersoc == -1)
     {
-      std::cout << "Unable to accept client_addr connection.\n";
+      LOG_ERROR("Unable to accept client_addr connection.");
       continue; // Continue accepting other connections
     }
 
+    int status;
+    int finished;
+    while ((finished = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+      auto child = children.find(finished);
+      if (child != children.end())
+      {
+        admission.release(child->second);
+        children.erase(child);
+      }
+    }
+
+    // before forking: a flood of connections must not exhaust the process table
+    bool admitted = admission.admit(client_addr.sin_addr.s_addr);
+    metrics.count_connection(admitted);
+    if (!admitted)
+    {
+      LOG_WARNING("Connection from " << inet_ntoa(client_addr.sin_addr) << " rejected by admission control");
+      close(peersoc);
+      continue;
+    }
+
     // get client_addr IP (convert it from network to address format)
     std::string client_addr_ip = inet_ntoa(client_addr.sin_addr);
     pid_t = fork();
 
     if (pid_t < 0)
     {
-      std::cout << "Error: Fork failed" << std::endl;
+      LOG_ERROR("Error: Fork failed");
       exit(EXIT_FAILURE);
     }
     else if (pid_t == 0)
     {
-      std::cout << "Accepted connection with file descriptor: " << peersoc << "\n";
+      LOG_DEBUG("Accepted connection with file descriptor: " << peersoc);
       close(socket_fd);
+      metrics_endpoint.reset(); // the parent answers scrapes
       // enter main cmd loop
       handle_communication(peersoc, client_addr_ip);
       exit(EXIT_SUCCESS);
     }
     else
     {
-      std::cout << "Parent process: forked child " << pid_t << " to handle communication with file descriptor  " << peersoc << "\n";
+      LOG_DEBUG("Parent process: forked child " << pid_t << " to handle communication with file descriptor  " << peersoc);
+      children[pid_t] = client_addr.sin_addr.s_addr;
       close(peersoc);
     }
   }
@@ -131,187 +303,378 @@ void Server::listen_for_connections()
 
 void Server::handle_communication(int consfd, std::string client_addr_ip)
 {
-  // each time a new client is connected, blacklist is cleaned
-  blacklist.cleanUp(&blacklist_sem);
-
-  ssize_t buffer_size = GenericConstants::STD_BUFFER_SIZE;
-  char *buffer = new char[buffer_size];
+  Connection conn;
+  conn.consfd = consfd;
+  conn.client_addr_ip = client_addr_ip;
 
-  bool valid_format = true;
-
-  while (true)
+  bool open = true;
+  while (open)
   {
-    ssize_t total_received = recv(consfd, buffer, buffer_size - 1, 0);
-    if (total_received <= 0)
+    // receive straight into the parser, it grows as needed for large bodies
+    char *buffer = conn.parser.write_ptr(ServerConstants::RECV_CHUNK_SIZE);
+    ssize_t received = recv(consfd, buffer, conn.parser.writable(), 0);
+    if (received <= 0)
     {
-      std::cout << "Receive error or connection closed.\n";
+      LOG_DEBUG("Receive error or connection closed.");
       break;
     }
+    conn.parser.commit(received);
 
-    buffer[total_received] = '\0'; // Null-terminate the received message
-
-    std::istringstream stream(buffer); // create stream for msg buffer
-    std::string command;
-    std::getline(stream, command); // get Command (first line)
-
-    std::string content_length_header;
-    std::getline(stream, content_length_header);
-    int content_length;
-
-    // check if content_length_header is correct Format(content-length: <length>),
-    // get length
-    if (check_content_length_header(content_length_header, content_length))
+    // a single read may carry several pipelined frames, or only part of one;
+    // all of them run in order and their replies go out together
+    Frame frame;
+    FrameParser::Status status;
+    while (open && (status = conn.parser.next(frame)) == FrameParser::Status::Complete)
     {
-      int message_length = command.length() + 1 + content_length_header.length() + 1 + content_length; // +1 for newLines
-      if (message_length > total_received)
+      LOG_DEBUG("Received " << frame.command << " with " << frame.content_length << " bytes");
+      open = dispatch_command(conn, frame);
+      if (conn.login_pending())
       {
-        resize_buffer(buffer, buffer_size, message_length + 1);
-
-        ssize_t remaining = buffer_size - total_received;
-        ssize_t received = recv(consfd, &buffer[total_received], remaining, 0);
-
-        total_received += received;
-
-        buffer[total_received] = '\0';
+        wait_for_login(conn);
       }
     }
-    else
+
+    if (open && status == FrameParser::Status::Invalid)
     {
-      valid_format = false;
+      // without a valid length the stream can not be resynchronised
+      LOG_WARNING("Message has invalid format");
+      append_server_response(conn.send_buffer, ServerConstants::RESPONSE_ERR, 4); // Respond with an error message
+      open = false;
     }
 
-    std::cout << "\n\nReceived:\n" << buffer << "\n";
-
-    if (!valid_format)
+    // blocking socket: flush only returns early on errors. The child has no
+    // other connections to share a group commit with, it syncs its own SENDs
+    if (!commit_connection(conn) || !flush_replies(conn))
     {
-      std::cout << "Message has invalid format" << std::endl;
-      send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0); // Respond with an error message
+      break;
     }
+  }
+  close(consfd);   // Ensure the peer socket is closed
+}
 
-    // QUIT to close conn
-    if (command == "QUIT")
+// Runs one complete request on behalf of conn.
+// Returns false if the connection should be closed afterwards (QUIT).
+// Replies are queued in conn.send_buffer, the caller flushes them.
+bool Server::dispatch_command(Connection &conn, const Frame &frame)
+{
+  std::string_view command = frame.command;
+  MetricCommand metric = Metrics::command_of(command);
+  auto started = std::chrono::steady_clock::now();
+  uint64_t allocations = AllocationCounter::thread_allocations();
+
+  // QUIT to close conn
+  if (command == "QUIT")
+  {
+    LOG_DEBUG("Closing connection with client_addr [FileDescriptor: " << conn.consfd << "]");
+    metrics.observe_request(metric, std::chrono::steady_clock::now() - started);
+    return false;
+  }
+  if (command == "LOGIN")
+  {
+    LOG_DEBUG("Processing LOGIN command");
+    handle_login(conn, frame.body);
+  }
+  else if (conn.logged_in)
+  {
+    if (command == "SEND")
     {
-      std::cout << "Closing connection with client_addr [FileDescriptor: " << consfd << "]\n";
-      close(consfd);
-      break;
+      LOG_DEBUG("Processing SEND command");
+      mail_manager.handle_send(conn.send_buffer, conn.arena, frame.body, conn.authenticated_user);
+      if (config.durability == Durability::GroupCommit)
+      {
+        conn.uncommitted_sends++; // its OK must not go out before the next commit
+      }
     }
-    if (command == "LOGIN")
+    else if (command == "LIST")
     {
-      std::cout << "Processing LOGIN command" << std::endl;
-      handle_login(consfd, buffer, authenticated_user, logged_in, client_addr_ip);
+      LOG_DEBUG("Processing LIST command");
+      mail_manager.handle_list(conn.send_buffer, conn.arena, conn.authenticated_user);
     }
-    else if (logged_in)
+    else if (command == "READ")
     {
-      if (command == "SEND")
-      {
-        std::cout << "Processing SEND command" << std::endl;
-        mail_manager.handle_send(consfd, buffer, authenticated_user, &mail_sem);
-      }
-      else if (command == "LIST")
-      {
-        std::cout << "Processing LIST command" << std::endl;
-        mail_manager.handle_list(consfd, authenticated_user, &mail_sem);
-      }
-      else if (command == "READ")
-      {
-        std::cout << "Processing READ command" << std::endl;
-        mail_manager.handle_read(consfd, buffer, authenticated_user, &mail_sem);
-      }
-      else if (command == "DEL")
-      {
-        std::cout << "Processing DEL command" << std::endl;
-        mail_manager.handle_delete(consfd, buffer, authenticated_user, &mail_sem);
-      }
-      else
-      {
-        std::cout << "Message has unknown command" << std::endl;
-        send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0); // Respond with an error message
-      }
+      LOG_DEBUG("Processing READ command");
+      mail_manager.handle_read(conn.send_buffer, conn.arena, frame.body, conn.authenticated_user);
+    }
+    else if (command == "DEL")
+    {
+      LOG_DEBUG("Processing DEL command");
+      mail_manager.handle_delete(conn.send_buffer, frame.body, conn.authenticated_user);
     }
     else
     {
-      std::cout << "User unauthorized" << std::endl;
-      send_server_response(consfd, ServerConstants::RESPONSE_UNAUTHORIZED, 13, 0);
+      LOG_DEBUG("Message has unknown command");
+      append_server_response(conn.send_buffer, ServerConstants::RESPONSE_ERR, 4); // Respond with an error message
     }
+    metrics.observe_storage(metric, std::chrono::steady_clock::now() - started);
   }
-  delete[] buffer; // Free the buffer memory
-  close(consfd);   // Ensure the peer socket is closed
+  else
+  {
+    LOG_DEBUG("User unauthorized");
+    append_server_response(conn.send_buffer, ServerConstants::RESPONSE_UNAUTHORIZED, 13);
+  }
+
+  // the reply is queued, nothing of the request is needed any more
+  conn.arena.reset();
+  metrics.observe_allocations(metric, AllocationCounter::thread_allocations() - allocations);
+
+  if (conn.login_pending())
+  {
+    conn.login.started = started; // recorded by finish_login() once the backend answered
+  }
+  else
+  {
+    metrics.observe_request(metric, std::chrono::steady_clock::now() - started);
+  }
+  return true;
 }
 
-void Server::handle_login(int consfd, const std::string &buffer, std::string &authenticated_user, bool &logged_in, std::string client_addr_ip)
+void Server::handle_login(Connection &conn, std::string_view body)
 {
-  try
+  const std::string &client_addr_ip = conn.client_addr_ip;
+
+  if (blacklist.is_blacklisted(client_addr_ip))
   {
-    if (blacklist.is_blacklisted(client_addr_ip, &blacklist_sem))
-    {
-      std::cout << "Blacklisted IP tried to login" << std::endl;
-      send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0); // Respond with an error message
-      return;
-    }
+    LOG_WARNING("Blacklisted IP tried to login");
+    append_server_response(conn.send_buffer, ServerConstants::RESPONSE_ERR, 4); // Respond with an error message
+    return;
   }
-  catch (const std::exception &e)
+
+  conn.attempted_logins_cnt++;
+  if (conn.attempted_logins_cnt > ServerConstants::MAX_LOGIN_ATTEMPTS)
   {
-    std::cout << e.what() << std::endl;
+
+    blacklist.add(client_addr_ip);
+    conn.attempted_logins_cnt = 0;
+    LOG_WARNING("Too many failed login attempts, IP " << client_addr_ip << " is now blacklisted.");
+    append_server_response(conn.send_buffer, ServerConstants::RESPONSE_ERR, 4); // Respond with an error message
+    return;
   }
 
-  attempted_logins_cnt++;
-  if (attempted_logins_cnt > ServerConstants::MAX_LOGIN_ATTEMPTS)
+  std::string_view username_line;
+  std::string_view password_line;
+
+  if (!next_line(body, username_line) || username_line.empty())
   {
+    LOG_DEBUG("Invalid Sender in LOGIN");
+    append_server_response(conn.send_buffer, ServerConstants::RESPONSE_ERR, 4); // Respond with an error message
+    return;
+  }
 
-    blacklist.add(client_addr_ip, &blacklist_sem);
-    attempted_logins_cnt = 0;
-    std::cout << "Too many failed login attempts, IP " << client_addr_ip << " is now blacklisted." << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0); // Respond with an error message
+  if (!next_line(body, password_line) || password_line.empty())
+  {
+    LOG_DEBUG("Invalid Password in LOGIN");
+    append_server_response(conn.send_buffer, ServerConstants::RESPONSE_ERR, 4); // Respond with an error message
     return;
   }
 
-  std::string line;
-  std::string username;
-  std::string password;
+  conn.login.username = std::string(username_line);
+  conn.login.password = std::string(password_line);
 
-  std::istringstream iss(buffer);
+  // the check runs asynchronously, finish_login() queues the reply once the
+  // cache or the backend answered
+  conn.login.state = PendingLogin::State::Waiting;
+  conn.login.retried = false;
+  conn.login.cache_checked = false;
+  conn.login.cache_lookup = false;
+  conn.login.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config.auth.start_timeout);
+}
 
-  std::getline(iss, line, '\n'); // skip command and content-length header
-  std::getline(iss, line, '\n');
+// Takes over the started check of the pending login. Returns true while it is
+// still running; otherwise the login is finished or set up for a retry.
+bool Server::begin_check(Connection &conn, std::unique_ptr<AuthAttempt> attempt)
+{
+  PendingLogin &login = conn.login;
+  login.attempt = std::move(attempt);
+  login.state = PendingLogin::State::Checking;
+  login.check_started = std::chrono::steady_clock::now();
+  login.deadline = login.check_started + std::chrono::seconds(config.auth.check_timeout);
+
+  // some backends answer right away
+  check_finished(conn, login.attempt->poll());
+  return login.state == PendingLogin::State::Checking;
+}
 
-  if (!std::getline(iss, username) || username.empty())
+void Server::check_finished(Connection &conn, AuthStatus status)
+{
+  PendingLogin &login = conn.login;
+  if (status == AuthStatus::Pending)
   {
-    std::cout << "Invalid Sender in LOGIN" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0); // Respond with an error message
     return;
   }
 
-  if (!std::getline(iss, password) || password.empty())
+  bool from_cache = login.cache_lookup;
+  login.cache_lookup = false;
+  if (status == AuthStatus::Miss)
+  {
+    login.attempt.reset();
+    login.state = PendingLogin::State::Waiting;
+    login.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config.auth.start_timeout);
+    return;
+  }
+  if (from_cache)
   {
-    std::cout << "Invalid Password in LOGIN" << std::endl;
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0); // Respond with an error message
+    LOG_DEBUG("Authentication cache hit for user: " << login.username);
+    finish_login(conn, status == AuthStatus::Accepted);
     return;
   }
+  metrics.observe_auth(std::chrono::steady_clock::now() - login.check_started);
 
-  // initialize ldap client obj and then try authenticate via SASL bind
-  std::string host_url = ServerConstants::HOST_URL;
-  LDAP_Module ldap_client = LDAP_Module(host_url);
+  if (status == AuthStatus::Lost && !login.retried)
+  {
+    // e.g. the pooled LDAP connection died while idle, that says nothing about the password
+    LOG_WARNING("Authentication backend connection lost, retrying");
+    login.retried = true;
+    login.attempt.reset();
+    login.state = PendingLogin::State::Waiting;
+    login.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config.auth.start_timeout);
+    return;
+  }
 
-  // try catch block to catch any LDAP related errors
-  try
+  // only real answers of the backend are cached, not timeouts or connection
+  // errors. The event loops leave the hashing to the cache's threads.
+  if (status == AuthStatus::Accepted || status == AuthStatus::Rejected)
   {
-    if (ldap_client.authenticate(username, password))
+    if (config.workers > 0 || config.use_reactor)
     {
-      logged_in = true;
-      authenticated_user = username;
-      send_server_response(consfd, ServerConstants::RESPONSE_OK, 3, 0);
+      auth_cache.store_later(login.username, login.password, status == AuthStatus::Accepted);
     }
     else
     {
-      send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
-      logged_in = false;
-      authenticated_user.clear();
-      attempted_logins_cnt++;
+      auth_cache.store(login.username, login.password, status == AuthStatus::Accepted);
     }
   }
-  catch (const std::exception &e)
+  finish_login(conn, status == AuthStatus::Accepted);
+}
+
+// Queues the reply of the pending login and releases its check
+void Server::finish_login(Connection &conn, bool success)
+{
+  if (success)
+  {
+    conn.logged_in = true;
+    conn.authenticated_user = conn.login.username;
+    append_server_response(conn.send_buffer, ServerConstants::RESPONSE_OK, 3);
+  }
+  else
+  {
+    append_server_response(conn.send_buffer, ServerConstants::RESPONSE_ERR, 4);
+    conn.logged_in = false;
+    conn.authenticated_user.clear();
+    conn.attempted_logins_cnt++;
+  }
+  if (conn.login.started != std::chrono::steady_clock::time_point())
+  {
+    metrics.observe_request(MetricCommand::Login, std::chrono::steady_clock::now() - conn.login.started);
+  }
+  conn.login = PendingLogin();
+}
+
+// Writes the queued replies of conn as far as the socket takes them
+bool Server::flush_replies(Connection &conn)
+{
+  if (conn.send_buffer.empty())
+  {
+    return true;
+  }
+  size_t queued = conn.send_buffer.size();
+  auto started = std::chrono::steady_clock::now();
+  bool ok = conn.send_buffer.flush(conn.consfd);
+  metrics.observe_socket_write(std::chrono::steady_clock::now() - started, queued - conn.send_buffer.size());
+  return ok;
+}
+
+// Group commit: one sync of the mail store makes every SEND written so far durable
+bool Server::commit_sends(size_t sends)
+{
+  auto started = std::chrono::steady_clock::now();
+  bool committed = mail_store->commit();
+  int error = errno;
+  metrics.observe_commit(std::chrono::steady_clock::now() - started, sends);
+  if (!committed)
+  {
+    LOG_ERROR("Group commit of " << sends << " SENDs failed: " << std::strerror(error));
+  }
+  return committed;
+}
+
+// Commits conn's SENDs right away instead of waiting for the next group commit.
+// Returns false if their OKs must not go out.
+bool Server::commit_connection(Connection &conn)
+{
+  if (conn.uncommitted_sends == 0)
   {
-    std::cout << e.what() << '\n';
-    send_server_response(consfd, ServerConstants::RESPONSE_ERR, 4, 0);
+    return true;
   }
-}
\ No newline at end of file
+  size_t sends = conn.uncommitted_sends;
+  conn.uncommitted_sends = 0;
+  return commit_sends(sends);
+}
+
+// Fork mode: the child serves a single client and may block until the check is
+// answered, but still notices when the client hangs up meanwhile.
+void Server::wait_for_login(Connection &conn)
+{
+  PendingLogin &login = conn.login;
+  int client_fd = conn.consfd;
+  while (conn.login_pending())
+  {
+    if (login.state == PendingLogin::State::Waiting && !login.cache_checked)
+    {
+      // scripted clients log in again and again, a known answer skips the directory.
+      // This process serves only this client, it may hash right here.
+      login.cache_checked = true;
+      AuthCache::Result cached = auth_cache.lookup(login.username, login.password);
+      if (cached != AuthCache::Result::Miss)
+      {
+        LOG_DEBUG("Authentication cache hit for user: " << login.username);
+        finish_login(conn, cached == AuthCache::Result::Accepted);
+        return;
+      }
+    }
+    if (login.state == PendingLogin::State::Waiting)
+    {
+      std::unique_ptr<AuthAttempt> attempt = authenticator->start(login.username, login.password);
+      if (!attempt)
+      {
+        finish_login(conn, false);
+        return;
+      }
+      begin_check(conn, std::move(attempt));
+      continue;
+    }
+
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(login.deadline - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0)
+    {
+      LOG_WARNING("Authentication timed out after " << config.auth.check_timeout << " sec");
+      login.attempt->abandon();
+      finish_login(conn, false);
+      return;
+    }
+
+    // no POLLIN for the client: further requests stay unread until the reply is out.
+    // Without a descriptor the attempt is polled on a short timer
+    int auth_fd = login.attempt->descriptor();
+    int timeout = auth_fd >= 0 ? remaining.count() : std::min<long>(remaining.count(), ServerConstants::LOGIN_POLL_INTERVAL);
+    struct pollfd fds[2] = {{auth_fd, POLLIN, 0}, {client_fd, POLLRDHUP, 0}};
+    int ready = poll(fds, 2, timeout);
+    if (ready == -1 && errno != EINTR)
+    {
+      login.attempt->abandon();
+      finish_login(conn, false);
+      return;
+    }
+    if (fds[1].revents & (POLLHUP | POLLERR))
+    {
+      // nobody is left to read the reply
+      login.attempt->abandon();
+      conn.login = PendingLogin();
+      return;
+    }
+    if (fds[1].revents & POLLRDHUP)
+    {
+      client_fd = -1; // half-closed, the client may still read the reply
+    }
+    check_finished(conn, login.attempt->poll());
+  }
+}
@@ -1,19 +1,66 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <atomic>
+#include <chrono>
 #include <filesystem>
+#include <memory>
+#include <netinet/in.h>
 #include <string>
-#include <semaphore.h>
+#include <thread>
+#include <vector>
+#include "admission_control.h"
+#include "connection.h"
+#include "metrics.h"
 #include "MailManager/mail_manager.h"
 #include "Blacklist/blacklist.h"
-#include "LdapModule/ldap_module.h"
+#include "Auth/authenticator.h"
+#include "Auth/auth_cache.h"
 
 namespace fs = std::filesystem;
 
-class Server 
+struct ServerConfig
+{
+    bool use_reactor = false; // single-process epoll event loop instead of fork-per-connection
+    int workers = 0;          // > 0: that many reactor threads, each with its own SO_REUSEPORT socket
+    bool pin_workers = false; // pin worker i to CPU i % cpu count
+    StorageLayout storage_layout = StorageLayout::Directory;
+    Durability durability = Durability::None;
+    int commit_window = 0;      // in ms a group commit waits for more SENDs, 0: only those of one event loop round
+    AuthConfig auth;
+    AuthCacheConfig auth_cache;
+    AdmissionConfig admission;
+    int blacklist_snapshot = 0; // in sec between blacklist file snapshots, 0: never written
+    int metrics_port = 0;       // loopback port for Prometheus scrapes, 0: no endpoint
+    bool use_io_uring = false;  // reactor threads do socket I/O through io_uring, epoll if unsupported
+};
+
+class IoUring;
+
+// One reactor thread with its own listening socket and epoll instance
+struct Worker
+{
+    int id = 0;
+    int listen_fd = -1;
+    int epoll_fd = -1;      // io_uring mode: authentication descriptors only
+    IoUring *ring = nullptr; // io_uring mode, owned by the event loop
+    std::thread thread;
+
+    std::vector<Connection *> pending_logins; // waiting for a credential check
+    std::vector<Connection *> closed;         // freed at the end of the epoll batch
+    std::vector<Connection *> commit_waiters; // replies held back for the next group commit
+    std::chrono::steady_clock::time_point commit_opened; // first waiter of the current group
+
+    // load counters, written by the worker and read by the stats reporter
+    std::atomic<unsigned long> connections_accepted{0};
+    std::atomic<unsigned long> connections_open{0};
+    std::atomic<unsigned long> requests{0};
+};
+
+class Server
 {
 public:
-    Server(int port, const std::filesystem::path& mail_directory);
+    Server(int port, const std::filesystem::path& mail_directory, const ServerConfig &config = ServerConfig());
     ~Server();
     void run();
 
@@ -21,20 +68,60 @@ public:
 private:
     int port;
     int socket_fd;
-    int attempted_logins_cnt;
-    bool logged_in=false;
-    std::string authenticated_user;
+    ServerConfig config;
+    std::vector<std::unique_ptr<Worker>> workers;
 
+    std::unique_ptr<MailStore> mail_store;
     MailManager mail_manager;
     Blacklist blacklist;
+    AdmissionControl admission;
+    std::unique_ptr<Authenticator> authenticator;
+    AuthCache auth_cache;
+    Metrics metrics;
+    std::unique_ptr<MetricsEndpoint> metrics_endpoint;
 
-    sem_t mail_sem;           // Semaphore for mail management
-    sem_t blacklist_sem;      // Semaphore for blacklist management
-
-    void init_socket();
+    int init_socket(bool reuse_port);
     void listen_for_connections();
     void handle_communication(int consfd, std::string client_addr_ip);
-    void handle_login(int consfd, const std::string &buffer, std::string &authenticated_user, bool &logged_in, std::string client_ip);
+    bool dispatch_command(Connection &conn, const Frame &frame);
+    void handle_login(Connection &conn, std::string_view body);
+    bool begin_check(Connection &conn, std::unique_ptr<AuthAttempt> attempt);
+    void check_finished(Connection &conn, AuthStatus status);
+    void finish_login(Connection &conn, bool success);
+    bool flush_replies(Connection &conn);
+    bool commit_sends(size_t sends);
+    bool commit_connection(Connection &conn);
+    void wait_for_login(Connection &conn);
+    void start_store_maintenance();
+    void start_blacklist_maintenance();
+    void start_metrics_endpoint();
+
+    // reactor mode (server_reactor.cpp)
+    void run_workers();
+    void run_event_loop(Worker &worker);
+    void accept_connections(Worker &worker);
+    bool service_connection(Worker &worker, Connection &conn);
+    bool dispatch_frames(Worker &worker, Connection &conn);
+    void close_connection(Worker &worker, Connection &conn);
+    void queue_login(Worker &worker, Connection &conn);
+    void start_check(Worker &worker, Connection &conn);
+    void progress_logins(Worker &worker);
+    void poll_check(Worker &worker, Connection &conn);
+    void unwatch_check(Worker &worker, Connection &conn);
+    void resume_connection(Worker &worker, Connection &conn);
+    void queue_commit(Worker &worker, Connection &conn);
+    bool commit_due(const Worker &worker) const;
+    int commit_timeout(const Worker &worker) const;
+    void finish_commit(Worker &worker);
+    std::unique_ptr<Connection> admit_connection(int peersoc, const struct sockaddr_in &client_addr);
+
+    // io_uring mode (server_uring.cpp)
+    void run_uring_loop(Worker &worker);
+    void uring_accepted(Worker &worker, int peersoc, const struct sockaddr_in &client_addr);
+    void uring_received(Worker &worker, Connection &conn, int result);
+    void uring_sent(Worker &worker, Connection &conn, int result);
+    void drive_connection(Worker &worker, Connection &conn);
+    void start_send(Worker &worker, Connection &conn);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,27 +1,294 @@
+#include <algorithm>
 #include <iostream>
 #include "server.h"
+#include "../utils/log.h"
 
 namespace fs = std::filesystem;
 
 int main(int argc, char* argv[]) 
 {
-    if (argc != 3) 
+    if (argc < 3) 
     {
-        std::cout << "Usage: ./twmailer-server <port> <mail-spool-directoryname>\n";
+        std::cout << "Usage: ./twmailer-server <port> <mail-spool-directoryname> [--reactor] [--workers <n>] [--pin-workers] [--io-uring] [--storage <dir|segment|memory>] [--durability <none|fsync-per-message|group-commit>] [--commit-window <ms>] [--auth <ldap|file|mock>] [--auth-file <path>] [--auth-latency <ms>] [--ldap-url <url>] [--ldap-base-dn <dn>] [--ldap-pool <n>] [--ldap-timeout <sec>] [--auth-cache <entries>] [--auth-cache-ttl <sec>] [--auth-negative-ttl <sec>] [--blacklist-snapshot <sec>] [--metrics-port <port>] [--log-level <debug|info|warning|error>] [--log-file <path>] [--max-connections <n>] [--max-per-ip <n>] [--ip-rate <per sec>]\n";
         return EXIT_FAILURE;
     }
 
     int port = std::stoi(argv[1]);
     fs::path mailDirectory(argv[2]);
 
+    ServerConfig config;
+    LogLevel log_level = LogLevel::Info;
+    std::string log_file; // empty: stdout
+    for (int i = 3; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--reactor")
+        {
+            config.use_reactor = true;
+        }
+        else if (option == "--workers" && i + 1 < argc)
+        {
+            config.workers = std::stoi(argv[++i]);
+            if (config.workers < 1)
+            {
+                std::cout << "--workers needs at least 1 worker\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--pin-workers")
+        {
+            config.pin_workers = true;
+        }
+        else if (option == "--io-uring")
+        {
+            config.use_io_uring = true;
+        }
+        else if (option == "--ldap-pool" && i + 1 < argc)
+        {
+            int size = std::stoi(argv[++i]);
+            if (size < 1)
+            {
+                std::cout << "--ldap-pool needs at least 1 connection\n";
+                return EXIT_FAILURE;
+            }
+            config.auth.ldap.size = size;
+        }
+        else if (option == "--ldap-timeout" && i + 1 < argc)
+        {
+            // connect, bind and waiting for a pooled connection
+            int timeout = std::stoi(argv[++i]);
+            if (timeout < 1)
+            {
+                std::cout << "--ldap-timeout needs at least 1 second\n";
+                return EXIT_FAILURE;
+            }
+            config.auth.ldap.network_timeout = timeout;
+            config.auth.ldap.operation_timeout = timeout;
+            config.auth.ldap.acquire_timeout = timeout;
+            config.auth.start_timeout = timeout;
+            config.auth.check_timeout = timeout;
+        }
+        else if (option == "--ldap-url" && i + 1 < argc)
+        {
+            config.auth.ldap.url = argv[++i];
+        }
+        else if (option == "--ldap-base-dn" && i + 1 < argc)
+        {
+            config.auth.ldap.base_dn = argv[++i];
+        }
+        else if (option == "--auth" && i + 1 < argc)
+        {
+            std::string method = argv[++i];
+            if (method == "ldap")
+            {
+                config.auth.method = AuthMethod::Ldap;
+            }
+            else if (method == "file")
+            {
+                config.auth.method = AuthMethod::File;
+            }
+            else if (method == "mock")
+            {
+                config.auth.method = AuthMethod::Mock;
+            }
+            else
+            {
+                std::cout << "--auth must be ldap, file or mock\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--auth-file" && i + 1 < argc)
+        {
+            config.auth.user_file = argv[++i];
+        }
+        else if (option == "--auth-latency" && i + 1 < argc)
+        {
+            config.auth.mock_latency = std::stoi(argv[++i]);
+            if (config.auth.mock_latency < 0)
+            {
+                std::cout << "--auth-latency can not be negative\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--auth-cache" && i + 1 < argc)
+        {
+            // 0 sends every LOGIN to the directory
+            int size = std::stoi(argv[++i]);
+            if (size < 0)
+            {
+                std::cout << "--auth-cache needs 0 or more entries\n";
+                return EXIT_FAILURE;
+            }
+            config.auth_cache.size = size;
+        }
+        else if ((option == "--auth-cache-ttl" || option == "--auth-negative-ttl") && i + 1 < argc)
+        {
+            int ttl = std::stoi(argv[++i]);
+            if (ttl < 1)
+            {
+                std::cout << option << " needs at least 1 second\n";
+                return EXIT_FAILURE;
+            }
+            if (option == "--auth-cache-ttl")
+            {
+                config.auth_cache.positive_ttl = ttl;
+            }
+            else
+            {
+                config.auth_cache.negative_ttl = ttl;
+            }
+        }
+        else if ((option == "--max-connections" || option == "--max-per-ip") && i + 1 < argc)
+        {
+            int limit = std::stoi(argv[++i]);
+            if (limit < 1)
+            {
+                std::cout << option << " needs at least 1 connection\n";
+                return EXIT_FAILURE;
+            }
+            if (option == "--max-connections")
+            {
+                config.admission.max_connections = limit;
+            }
+            else
+            {
+                config.admission.max_per_ip = limit;
+            }
+        }
+        else if (option == "--ip-rate" && i + 1 < argc)
+        {
+            // new connections per second and IP, bursts of twice that; 0 turns the limit off
+            double rate = std::stod(argv[++i]);
+            if (rate < 0)
+            {
+                std::cout << "--ip-rate can not be negative\n";
+                return EXIT_FAILURE;
+            }
+            config.admission.ip_rate = rate;
+            config.admission.ip_burst = std::max(1.0, 2 * rate);
+        }
+        else if (option == "--blacklist-snapshot" && i + 1 < argc)
+        {
+            config.blacklist_snapshot = std::stoi(argv[++i]);
+            if (config.blacklist_snapshot < 0)
+            {
+                std::cout << "--blacklist-snapshot can not be negative\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--log-level" && i + 1 < argc)
+        {
+            if (!Log::parse_level(argv[++i], log_level))
+            {
+                std::cout << "--log-level must be debug, info, warning or error\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--log-file" && i + 1 < argc)
+        {
+            log_file = argv[++i];
+        }
+        else if (option == "--metrics-port" && i + 1 < argc)
+        {
+            config.metrics_port = std::stoi(argv[++i]);
+            if (config.metrics_port < 1 || config.metrics_port > 65535)
+            {
+                std::cout << "--metrics-port must be a port number\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--storage" && i + 1 < argc)
+        {
+            std::string layout = argv[++i];
+            if (layout == "dir")
+            {
+                config.storage_layout = StorageLayout::Directory;
+            }
+            else if (layout == "segment")
+            {
+                config.storage_layout = StorageLayout::Segment;
+            }
+            else if (layout == "memory")
+            {
+                config.storage_layout = StorageLayout::Memory;
+            }
+            else
+            {
+                std::cout << "--storage must be dir, segment or memory\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--durability" && i + 1 < argc)
+        {
+            std::string mode = argv[++i];
+            if (mode == "none")
+            {
+                config.durability = Durability::None;
+            }
+            else if (mode == "fsync-per-message")
+            {
+                config.durability = Durability::FsyncPerMessage;
+            }
+            else if (mode == "group-commit")
+            {
+                config.durability = Durability::GroupCommit;
+            }
+            else
+            {
+                std::cout << "--durability must be none, fsync-per-message or group-commit\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (option == "--commit-window" && i + 1 < argc)
+        {
+            config.commit_window = std::stoi(argv[++i]);
+            if (config.commit_window < 0)
+            {
+                std::cout << "--commit-window can not be negative\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            std::cout << "Unknown option: " << option << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (config.auth.method == AuthMethod::File && config.auth.user_file.empty())
+    {
+        std::cout << "--auth file needs --auth-file <path>\n";
+        return EXIT_FAILURE;
+    }
+
+    // io_uring drives the reactor's event loop, on its own it means a single reactor
+    if (config.use_io_uring && config.workers == 0)
+    {
+        config.use_reactor = true;
+    }
+
+    // forked children would each write into their own copy of the memory store
+    if (config.storage_layout == StorageLayout::Memory && !config.use_reactor && config.workers == 0)
+    {
+        std::cout << "--storage memory needs --reactor or --workers\n";
+        return EXIT_FAILURE;
+    }
+
+    if (config.storage_layout == StorageLayout::Memory && config.durability != Durability::None)
+    {
+        std::cout << "--durability needs --storage dir or segment\n";
+        return EXIT_FAILURE;
+    }
+
     try 
     {
-        Server server(port, mailDirectory);
+        Log::start(log_level, log_file);
+        Server server(port, mailDirectory, config);
         server.run();
     } 
     catch (const std::exception &e) 
     {
-        std::cout << "Error: " << e.what() << "\n";
+        LOG_ERROR("Error: " << e.what());
         return EXIT_FAILURE;
     }
 
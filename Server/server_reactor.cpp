@@ -0,0 +1,577 @@
+#include "server.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../utils/helpers.h"
+#include "../utils/constants.h"
+#include "../utils/log.h"
+
+// Reactor mode: one process multiplexes every client socket with an
+// edge-triggered epoll instance instead of forking a child per connection.
+
+static void set_non_blocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+  {
+    throw std::runtime_error("Unable to set O_NONBLOCK: " + std::to_string(errno));
+  }
+}
+
+// Starts one event loop thread per worker and periodically reports their load
+void Server::run_workers()
+{
+  unsigned int cpu_count = std::thread::hardware_concurrency();
+
+  for (auto &worker : workers)
+  {
+    Worker *w = worker.get();
+    w->thread = std::thread([this, w]()
+    {
+      try
+      {
+        config.use_io_uring ? run_uring_loop(*w) : run_event_loop(*w);
+      }
+      catch (const std::exception &e)
+      {
+        LOG_ERROR("Worker " << w->id << " stopped: " << e.what());
+      }
+    });
+
+    if (config.pin_workers && cpu_count > 0)
+    {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(w->id % cpu_count, &cpus);
+      if (pthread_setaffinity_np(w->thread.native_handle(), sizeof(cpus), &cpus) != 0)
+      {
+        LOG_WARNING("Unable to pin worker " << w->id << " to CPU " << w->id % cpu_count);
+      }
+    }
+  }
+
+  LOG_INFO("Started " << workers.size() << " workers on port " << port);
+
+  // the workers never return, so the main thread only reports how evenly the kernel spreads the load
+  while (true)
+  {
+    sleep(ServerConstants::WORKER_STATS_INTERVAL);
+    for (const auto &worker : workers)
+    {
+      LOG_INFO("Worker " << worker->id
+               << ": accepted=" << worker->connections_accepted.load(std::memory_order_relaxed)
+               << " open=" << worker->connections_open.load(std::memory_order_relaxed)
+               << " requests=" << worker->requests.load(std::memory_order_relaxed));
+    }
+    LOG_INFO("Auth cache: hits=" << auth_cache.hits() << " misses=" << auth_cache.misses());
+    LOG_INFO("Admission control: rejected=" << admission.rejected());
+  }
+}
+
+void Server::run_event_loop(Worker &worker)
+{
+  // a client closing early must not kill the whole server via SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+  set_non_blocking(worker.listen_fd);
+
+  int epoll_fd = epoll_create1(0);
+  if (epoll_fd == -1)
+  {
+    throw std::runtime_error("Unable to create epoll instance: " + std::to_string(errno));
+  }
+  worker.epoll_fd = epoll_fd;
+
+  // the listening socket is registered with a null pointer, everything else with its EventSource
+  struct epoll_event listen_event = {};
+  listen_event.events = EPOLLIN | EPOLLET;
+  listen_event.data.ptr = nullptr;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, worker.listen_fd, &listen_event) == -1)
+  {
+    close(epoll_fd);
+    throw std::runtime_error("Unable to register server socket with epoll: " + std::to_string(errno));
+  }
+
+  LOG_INFO("Reactor " << worker.id << ": waiting for connections on port " << port);
+
+  struct epoll_event events[ServerConstants::MAX_EPOLL_EVENTS];
+  while (true)
+  {
+    // logins waiting for a handle or a deadline need a tick even without events,
+    // an open group commit has to end once its window is over
+    int timeout = worker.pending_logins.empty() ? -1 : ServerConstants::LOGIN_POLL_INTERVAL;
+    if (!worker.commit_waiters.empty())
+    {
+      timeout = timeout == -1 ? commit_timeout(worker) : std::min(timeout, commit_timeout(worker));
+    }
+    int ready = epoll_wait(epoll_fd, events, ServerConstants::MAX_EPOLL_EVENTS, timeout);
+    if (ready == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      close(epoll_fd);
+      throw std::runtime_error("epoll_wait failed: " + std::to_string(errno));
+    }
+
+    for (int i = 0; i < ready; i++)
+    {
+      if (events[i].data.ptr == nullptr)
+      {
+        accept_connections(worker);
+        continue;
+      }
+
+      EventSource *source = static_cast<EventSource *>(events[i].data.ptr);
+      Connection *conn = source->conn;
+      if (conn->closed)
+      {
+        continue; // closed by an earlier event of this batch
+      }
+      if (source->kind == EventSource::Kind::Auth)
+      {
+        poll_check(worker, *conn);
+        continue;
+      }
+
+      bool keep_open = !(events[i].events & (EPOLLERR | EPOLLHUP)) && service_connection(worker, *conn);
+      if (!keep_open)
+      {
+        close_connection(worker, *conn);
+      }
+    }
+
+    if (!worker.pending_logins.empty())
+    {
+      progress_logins(worker);
+    }
+    if (commit_due(worker))
+    {
+      finish_commit(worker);
+    }
+
+    // events later in the batch may still point to these, so they are freed only now
+    for (Connection *conn : worker.closed)
+    {
+      delete conn;
+    }
+    worker.closed.clear();
+  }
+}
+
+// Edge-triggered: drain the accept queue until it would block
+void Server::accept_connections(Worker &worker)
+{
+  while (true)
+  {
+    struct sockaddr_in client_addr;
+    socklen_t addrlen = sizeof(client_addr);
+    int peersoc = accept4(worker.listen_fd, (struct sockaddr *)&client_addr, &addrlen, SOCK_NONBLOCK);
+    if (peersoc == -1)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      {
+        LOG_ERROR("Unable to accept client_addr connection.");
+      }
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return;
+    }
+
+    std::unique_ptr<Connection> conn = admit_connection(peersoc, client_addr);
+    if (!conn)
+    {
+      continue;
+    }
+
+    struct epoll_event event = {};
+    // EPOLLOUT is edge-triggered as well, it only fires when a full send buffer drains
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = &conn->client_source;
+    if (epoll_ctl(worker.epoll_fd, EPOLL_CTL_ADD, peersoc, &event) == -1)
+    {
+      LOG_ERROR("Unable to register client with epoll: " << errno);
+      admission.release(conn->client_ip);
+      close(peersoc);
+      continue;
+    }
+
+    LOG_DEBUG("Accepted connection with file descriptor: " << peersoc);
+    conn.release(); // owned by the event loop until the connection is closed
+    worker.connections_accepted.fetch_add(1, std::memory_order_relaxed);
+    worker.connections_open.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+// Admission control for a freshly accepted socket, shared by both event loops.
+// Returns nullptr if the client was turned away, its socket is closed then.
+std::unique_ptr<Connection> Server::admit_connection(int peersoc, const struct sockaddr_in &client_addr)
+{
+  // before anything is allocated for the client
+  bool admitted = admission.admit(client_addr.sin_addr.s_addr);
+  metrics.count_connection(admitted);
+  if (!admitted)
+  {
+    LOG_WARNING("Connection from " << inet_ntoa(client_addr.sin_addr) << " rejected by admission control");
+    close(peersoc);
+    return nullptr;
+  }
+
+  std::unique_ptr<Connection> conn(new Connection());
+  conn->consfd = peersoc;
+  conn->client_addr_ip = inet_ntoa(client_addr.sin_addr);
+  conn->client_ip = client_addr.sin_addr.s_addr;
+  return conn;
+}
+
+// Called on every readiness change of conn: reads and runs every request that arrived
+// and flushes their batched replies. Returns false if the connection has to be closed.
+bool Server::service_connection(Worker &worker, Connection &conn)
+{
+  while (true)
+  {
+    bool keep_open = true;
+    bool would_block = false;
+
+    // Edge-triggered: read until the socket would block, or until the client stops
+    // taking its replies; EPOLLOUT brings us back here once they drained. A pending
+    // login stops reading as well, resume_connection() continues once it is answered
+    while (keep_open && !would_block && !conn.login_pending() && conn.send_buffer.size() < ServerConstants::MAX_PENDING_OUTPUT)
+    {
+      char *buffer = conn.parser.write_ptr(ServerConstants::RECV_CHUNK_SIZE);
+      ssize_t received = recv(conn.consfd, buffer, conn.parser.writable(), 0);
+      if (received > 0)
+      {
+        conn.parser.commit(received);
+        // dispatch before the next recv, it may move the bytes the frames point to
+        keep_open = dispatch_frames(worker, conn);
+      }
+      else if (received == 0)
+      {
+        keep_open = false; // peer closed
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        would_block = true;
+      }
+      else if (errno != EINTR)
+      {
+        LOG_DEBUG("Receive error on file descriptor " << conn.consfd << ".");
+        return false;
+      }
+    }
+
+    // OKs of SENDs wait for the worker's next group commit, finish_commit()
+    // continues here; the last replies before closing do not wait for others
+    if (keep_open && conn.uncommitted_sends > 0)
+    {
+      queue_commit(worker, conn);
+      return true;
+    }
+
+    // one send for all replies of this round, also the last ones before closing
+    if (!commit_connection(conn) || !flush_replies(conn) || !keep_open)
+    {
+      return false;
+    }
+    if (would_block || !conn.send_buffer.empty() || conn.login_pending())
+    {
+      return true; // wait for the next EPOLLIN or EPOLLOUT edge, or the login
+    }
+    // stopped for backpressure but everything went out: keep reading
+  }
+}
+
+// Runs every complete frame buffered for conn, in order, up to the first LOGIN
+// that has to wait for its credential check
+bool Server::dispatch_frames(Worker &worker, Connection &conn)
+{
+  Frame frame;
+  FrameParser::Status status = FrameParser::Status::NeedMore;
+  while (!conn.login_pending() && (status = conn.parser.next(frame)) == FrameParser::Status::Complete)
+  {
+    worker.requests.fetch_add(1, std::memory_order_relaxed);
+    LOG_DEBUG("Received " << frame.command << " with " << frame.content_length << " bytes");
+    if (!dispatch_command(conn, frame))
+    {
+      return false;
+    }
+    if (conn.login_pending())
+    {
+      queue_login(worker, conn);
+    }
+  }
+
+  if (status == FrameParser::Status::Invalid)
+  {
+    // without a valid length the stream can not be resynchronised
+    LOG_WARNING("Message has invalid format");
+    append_server_response(conn.send_buffer, ServerConstants::RESPONSE_ERR, 4);
+    return false;
+  }
+  return true;
+}
+
+// Closes conn and cancels its login; the object is freed at the end of the epoll batch
+void Server::close_connection(Worker &worker, Connection &conn)
+{
+  LOG_DEBUG("Closing connection with file descriptor: " << conn.consfd);
+  if (conn.login_pending())
+  {
+    if (conn.login.state == PendingLogin::State::Checking)
+    {
+      unwatch_check(worker, conn);
+      conn.login.attempt->abandon();
+    }
+    conn.login = PendingLogin();
+    worker.pending_logins.erase(std::remove(worker.pending_logins.begin(), worker.pending_logins.end(), &conn), worker.pending_logins.end());
+  }
+  if (conn.commit_queued)
+  {
+    worker.commit_waiters.erase(std::remove(worker.commit_waiters.begin(), worker.commit_waiters.end(), &conn), worker.commit_waiters.end());
+  }
+
+  // closing the descriptor also removes it from the epoll interest list; io_uring
+  // operations keep the socket alive, shutting it down ends them
+  if (worker.ring != nullptr)
+  {
+    shutdown(conn.consfd, SHUT_RDWR);
+  }
+  close(conn.consfd);
+  admission.release(conn.client_ip);
+  conn.closed = true;
+  worker.closed.push_back(&conn);
+  worker.connections_open.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// A LOGIN was dispatched: its check starts right away if the backend has
+// capacity, otherwise progress_logins() keeps trying until the start deadline
+void Server::queue_login(Worker &worker, Connection &conn)
+{
+  start_check(worker, conn);
+  if (conn.login_pending())
+  {
+    worker.pending_logins.push_back(&conn);
+  }
+}
+
+void Server::start_check(Worker &worker, Connection &conn)
+{
+  // a known answer skips the directory; the cache hashes on its own threads
+  // and its attempt is watched like a backend check
+  std::unique_ptr<AuthAttempt> attempt;
+  if (!conn.login.cache_checked)
+  {
+    conn.login.cache_checked = true;
+    attempt = auth_cache.start_lookup(conn.login.username, conn.login.password);
+    conn.login.cache_lookup = attempt != nullptr;
+  }
+  if (!attempt)
+  {
+    attempt = authenticator->try_start(conn.login.username, conn.login.password);
+  }
+  if (!attempt || !begin_check(conn, std::move(attempt)))
+  {
+    return; // still waiting for capacity, already answered, or set up for a retry
+  }
+
+  int auth_fd = conn.login.attempt->descriptor();
+  if (auth_fd < 0)
+  {
+    return; // polled by progress_logins()
+  }
+
+  // level-triggered, an LDAP answer may arrive in pieces
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = &conn.auth_source;
+  if (epoll_ctl(worker.epoll_fd, EPOLL_CTL_ADD, auth_fd, &event) == -1)
+  {
+    LOG_ERROR("Unable to register authentication with epoll: " << errno);
+    conn.login.attempt->abandon();
+    finish_login(conn, false);
+    return;
+  }
+  conn.login.watched_fd = auth_fd;
+}
+
+// Collects the result of conn's running check, called when its descriptor is
+// readable or on the timer for attempts without one
+void Server::poll_check(Worker &worker, Connection &conn)
+{
+  if (conn.login.state != PendingLogin::State::Checking)
+  {
+    return;
+  }
+
+  AuthStatus status = conn.login.attempt->poll();
+  if (status == AuthStatus::Pending)
+  {
+    return;
+  }
+  // before the attempt releases its resources, e.g. an LDAP handle another worker may register next
+  unwatch_check(worker, conn);
+  check_finished(conn, status);
+
+  if (!conn.login_pending())
+  {
+    worker.pending_logins.erase(std::remove(worker.pending_logins.begin(), worker.pending_logins.end(), &conn), worker.pending_logins.end());
+    resume_connection(worker, conn);
+  }
+}
+
+void Server::unwatch_check(Worker &worker, Connection &conn)
+{
+  if (conn.login.watched_fd >= 0)
+  {
+    epoll_ctl(worker.epoll_fd, EPOLL_CTL_DEL, conn.login.watched_fd, nullptr);
+    conn.login.watched_fd = -1;
+  }
+}
+
+// Starts checks that waited for capacity, polls checks without a descriptor,
+// enforces deadlines and resumes every connection whose login got its reply
+void Server::progress_logins(Worker &worker)
+{
+  auto now = std::chrono::steady_clock::now();
+  std::vector<Connection *> waiting;
+  waiting.swap(worker.pending_logins);
+
+  for (Connection *conn : waiting)
+  {
+    PendingLogin &login = conn->login;
+    if (login.state == PendingLogin::State::Waiting)
+    {
+      if (now >= login.deadline)
+      {
+        LOG_WARNING("Authentication backend busy for " << config.auth.start_timeout << " sec");
+        finish_login(*conn, false);
+      }
+      else
+      {
+        start_check(worker, *conn);
+      }
+    }
+    else if (login.state == PendingLogin::State::Checking && now >= login.deadline)
+    {
+      unwatch_check(worker, *conn);
+      login.attempt->abandon();
+      if (login.cache_lookup)
+      {
+        // the hashing threads are backed up, the backend answers instead
+        check_finished(*conn, AuthStatus::Miss);
+      }
+      else
+      {
+        LOG_WARNING("Authentication timed out after " << config.auth.check_timeout << " sec");
+        finish_login(*conn, false);
+      }
+    }
+    else if (login.state == PendingLogin::State::Checking && login.watched_fd < 0)
+    {
+      AuthStatus status = login.attempt->poll();
+      check_finished(*conn, status);
+    }
+
+    if (conn->login_pending())
+    {
+      worker.pending_logins.push_back(conn);
+      continue;
+    }
+    resume_connection(worker, *conn);
+  }
+}
+
+// conn's login got its reply: run the frames that queued up behind it, then
+// read on where service_connection() stopped
+void Server::resume_connection(Worker &worker, Connection &conn)
+{
+  if (worker.ring != nullptr)
+  {
+    drive_connection(worker, conn);
+    return;
+  }
+
+  bool keep_open = dispatch_frames(worker, conn);
+  if (!keep_open && commit_connection(conn))
+  {
+    flush_replies(conn);
+  }
+  if (!keep_open || !service_connection(worker, conn))
+  {
+    close_connection(worker, conn);
+  }
+}
+
+// conn's replies include OKs of SENDs: they go out with the worker's next group commit
+void Server::queue_commit(Worker &worker, Connection &conn)
+{
+  if (conn.commit_queued)
+  {
+    return;
+  }
+  if (worker.commit_waiters.empty())
+  {
+    worker.commit_opened = std::chrono::steady_clock::now();
+  }
+  conn.commit_queued = true;
+  worker.commit_waiters.push_back(&conn);
+}
+
+// A group is committed once its window is over; without a window at the end of
+// the event loop round that opened it
+bool Server::commit_due(const Worker &worker) const
+{
+  return !worker.commit_waiters.empty() &&
+         std::chrono::steady_clock::now() - worker.commit_opened >= std::chrono::milliseconds(config.commit_window);
+}
+
+// ms until the open group is due
+int Server::commit_timeout(const Worker &worker) const
+{
+  auto due = worker.commit_opened + std::chrono::milliseconds(config.commit_window);
+  auto remaining = std::chrono::ceil<std::chrono::milliseconds>(due - std::chrono::steady_clock::now());
+  return std::max<long>(remaining.count(), 0);
+}
+
+// One sync for every SEND of the group, then their replies are released. If it
+// failed nobody learns their mail was stored, the connections are closed.
+void Server::finish_commit(Worker &worker)
+{
+  std::vector<Connection *> waiting;
+  waiting.swap(worker.commit_waiters);
+
+  size_t sends = 0;
+  for (Connection *conn : waiting)
+  {
+    sends += conn->uncommitted_sends;
+  }
+  bool committed = commit_sends(sends);
+
+  for (Connection *conn : waiting)
+  {
+    conn->commit_queued = false;
+    conn->uncommitted_sends = 0;
+    if (conn->closed)
+    {
+      continue;
+    }
+    if (!committed)
+    {
+      close_connection(worker, *conn);
+      continue;
+    }
+    resume_connection(worker, *conn); // may open the next group
+  }
+}
@@ -0,0 +1,314 @@
+#include "server.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "uring.h"
+#include "../utils/helpers.h"
+#include "../utils/constants.h"
+#include "../utils/log.h"
+
+// io_uring mode: the reactor's event loop, but instead of waiting for readiness
+// and calling recv()/sendmsg() itself it hands accept, recv and sendmsg
+// operations to the kernel and reacts to their completions. Everything queued
+// while a batch of completions is handled goes out with the io_uring_enter()
+// that also waits for the next batch.
+//
+// Authentication descriptors stay in the worker's epoll set, which is watched
+// with a poll operation, so the login handling is shared with epoll mode. File
+// regions of READ replies are still sent with sendfile(), only the wait for a
+// full socket goes through the ring; mail store I/O stays synchronous as in
+// epoll mode.
+
+// What a completion belongs to: the operation in the low bits of user_data,
+// the connection (at least 8-byte aligned) in the others
+enum UringOp : uint64_t
+{
+  Accept,
+  AuthReady,  // poll on the epoll set of the authentication descriptors
+  LoginTimer, // pending logins need a tick
+  CommitTimer, // the window of the open group commit is over
+  Recv,
+  Send,
+  Writable    // poll for a full socket in front of a file region
+};
+static constexpr uint64_t OP_MASK = 7;
+
+static uint64_t tag(UringOp op, Connection *conn = nullptr)
+{
+  return reinterpret_cast<uintptr_t>(conn) | op;
+}
+
+void Server::run_uring_loop(Worker &worker)
+{
+  // a client closing early must not kill the whole server via SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+
+  IoUring ring(ServerConstants::URING_ENTRIES);
+  worker.ring = &ring;
+  worker.epoll_fd = epoll_create1(0);
+  if (worker.epoll_fd == -1)
+  {
+    throw std::runtime_error("Unable to create epoll instance: " + std::to_string(errno));
+  }
+
+  // one accept in flight at a time, its completion queues the next
+  struct sockaddr_in client_addr;
+  socklen_t addrlen = sizeof(client_addr);
+  ring.prepare_accept(worker.listen_fd, (struct sockaddr *)&client_addr, &addrlen, SOCK_NONBLOCK, tag(Accept));
+  ring.prepare_poll(worker.epoll_fd, POLLIN, tag(AuthReady));
+
+  struct __kernel_timespec login_interval = {0, ServerConstants::LOGIN_POLL_INTERVAL * 1000000LL};
+  bool timer_queued = false;
+  struct __kernel_timespec commit_interval = {};
+  bool commit_timer_queued = false;
+
+  LOG_INFO("Reactor " << worker.id << " (io_uring): waiting for connections on port " << port);
+
+  struct io_uring_cqe completions[ServerConstants::MAX_EPOLL_EVENTS];
+  while (true)
+  {
+    // logins waiting for a handle or a deadline need a tick even without completions
+    if (!worker.pending_logins.empty() && !timer_queued)
+    {
+      ring.prepare_timeout(&login_interval, tag(LoginTimer));
+      timer_queued = true;
+    }
+    // without a window the group is committed after the batch that opened it
+    if (!worker.commit_waiters.empty() && config.commit_window > 0 && !commit_timer_queued)
+    {
+      commit_interval.tv_nsec = commit_timeout(worker) * 1000000LL;
+      ring.prepare_timeout(&commit_interval, tag(CommitTimer));
+      commit_timer_queued = true;
+    }
+    ring.submit_and_wait();
+
+    unsigned count = ring.completions(completions, ServerConstants::MAX_EPOLL_EVENTS);
+    for (unsigned i = 0; i < count; i++)
+    {
+      const struct io_uring_cqe &completion = completions[i];
+      Connection *conn = reinterpret_cast<Connection *>(completion.user_data & ~OP_MASK);
+      switch (completion.user_data & OP_MASK)
+      {
+      case Accept:
+        if (completion.res >= 0)
+        {
+          uring_accepted(worker, completion.res, client_addr);
+        }
+        else if (completion.res != -EINTR && completion.res != -EAGAIN)
+        {
+          LOG_ERROR("Unable to accept client_addr connection: " << std::strerror(-completion.res));
+        }
+        addrlen = sizeof(client_addr);
+        ring.prepare_accept(worker.listen_fd, (struct sockaddr *)&client_addr, &addrlen, SOCK_NONBLOCK, tag(Accept));
+        break;
+
+      case AuthReady:
+      {
+        struct epoll_event events[ServerConstants::MAX_EPOLL_EVENTS];
+        int ready = epoll_wait(worker.epoll_fd, events, ServerConstants::MAX_EPOLL_EVENTS, 0);
+        for (int j = 0; j < ready; j++)
+        {
+          Connection *checked = static_cast<EventSource *>(events[j].data.ptr)->conn;
+          if (!checked->closed)
+          {
+            poll_check(worker, *checked);
+          }
+        }
+        ring.prepare_poll(worker.epoll_fd, POLLIN, tag(AuthReady));
+        break;
+      }
+
+      case LoginTimer:
+        timer_queued = false;
+        if (!worker.pending_logins.empty())
+        {
+          progress_logins(worker);
+        }
+        break;
+
+      case CommitTimer:
+        commit_timer_queued = false;
+        break;
+
+      case Recv:
+        conn->inflight--;
+        conn->receiving = false;
+        if (!conn->closed)
+        {
+          uring_received(worker, *conn, completion.res);
+        }
+        break;
+
+      case Send:
+      case Writable:
+        conn->inflight--;
+        conn->sending = false;
+        if (!conn->closed)
+        {
+          // a poll completes with the ready events, only sendmsg with a byte count
+          uring_sent(worker, *conn, (completion.user_data & OP_MASK) == Send ? completion.res : std::min(completion.res, 0));
+        }
+        break;
+      }
+    }
+
+    if (commit_due(worker))
+    {
+      finish_commit(worker);
+    }
+
+    // closed connections are freed once no operation in flight points to them anymore
+    auto freed = std::remove_if(worker.closed.begin(), worker.closed.end(), [](Connection *conn)
+    {
+      if (conn->inflight > 0)
+      {
+        return false;
+      }
+      delete conn;
+      return true;
+    });
+    worker.closed.erase(freed, worker.closed.end());
+  }
+}
+
+void Server::uring_accepted(Worker &worker, int peersoc, const struct sockaddr_in &client_addr)
+{
+  std::unique_ptr<Connection> conn = admit_connection(peersoc, client_addr);
+  if (!conn)
+  {
+    return;
+  }
+
+  LOG_DEBUG("Accepted connection with file descriptor: " << peersoc);
+  worker.connections_accepted.fetch_add(1, std::memory_order_relaxed);
+  worker.connections_open.fetch_add(1, std::memory_order_relaxed);
+  drive_connection(worker, *conn.release()); // owned by the event loop until the connection is closed
+}
+
+void Server::uring_received(Worker &worker, Connection &conn, int result)
+{
+  if (result > 0)
+  {
+    conn.parser.commit(result);
+  }
+  else if (result == 0)
+  {
+    conn.closing = true; // peer closed, what is queued still goes out
+  }
+  else if (result != -EINTR && result != -EAGAIN)
+  {
+    LOG_DEBUG("Receive error on file descriptor " << conn.consfd << ".");
+    close_connection(worker, conn);
+    return;
+  }
+  drive_connection(worker, conn);
+}
+
+// result: bytes sent by sendmsg, 0 once a full socket has room again
+void Server::uring_sent(Worker &worker, Connection &conn, int result)
+{
+  if (result < 0 && result != -EINTR && result != -EAGAIN)
+  {
+    LOG_ERROR("Sending response failed: " << std::strerror(-result));
+    close_connection(worker, conn);
+    return;
+  }
+  if (result > 0)
+  {
+    metrics.observe_socket_write(std::chrono::steady_clock::now() - conn.send_started, result);
+    conn.send_buffer.consume(result); // a short write continues in the middle of a chunk
+  }
+  drive_connection(worker, conn);
+}
+
+// Moves conn on after any completion: runs the buffered frames, sends their
+// replies and keeps a recv in flight. The counterpart of service_connection().
+void Server::drive_connection(Worker &worker, Connection &conn)
+{
+  // replies are only appended while no send points into the queue and no
+  // group commit holds them back; frames received meanwhile wait in the parser
+  bool held = conn.sending || conn.commit_queued;
+  if (!held && !conn.closing && !conn.login_pending())
+  {
+    conn.closing = !dispatch_frames(worker, conn);
+  }
+
+  // OKs of SENDs go out with the worker's next group commit, finish_commit()
+  // drives the connection on; the last replies before closing do not wait
+  if (!conn.sending && conn.uncommitted_sends > 0 && !conn.closing)
+  {
+    queue_commit(worker, conn);
+  }
+  else if (!conn.sending && !commit_connection(conn))
+  {
+    close_connection(worker, conn);
+    return;
+  }
+
+  if (!conn.sending && conn.uncommitted_sends == 0 && !conn.send_buffer.empty())
+  {
+    start_send(worker, conn);
+    if (conn.closed)
+    {
+      return;
+    }
+  }
+
+  if (conn.closing)
+  {
+    if (!conn.sending)
+    {
+      close_connection(worker, conn);
+    }
+    return;
+  }
+
+  // a partial frame always needs more bytes, only complete ones waiting for a
+  // send or a login limit what is read ahead
+  bool blocked = conn.sending || conn.commit_queued || conn.login_pending();
+  if (!conn.receiving && (!blocked || conn.parser.buffered() < ServerConstants::URING_MAX_BUFFERED_INPUT))
+  {
+    // the parser only moves its bytes in write_ptr(), never while the recv is in flight
+    char *buffer = conn.parser.write_ptr(ServerConstants::RECV_CHUNK_SIZE);
+    worker.ring->prepare_recv(conn.consfd, buffer, conn.parser.writable(), tag(Recv, &conn));
+    conn.receiving = true;
+    conn.inflight++;
+  }
+}
+
+void Server::start_send(Worker &worker, Connection &conn)
+{
+  if (conn.send_buffer.file_in_front())
+  {
+    // sendfile() straight from the page cache, the ring only waits for room in the socket
+    if (!flush_replies(conn))
+    {
+      close_connection(worker, conn);
+      return;
+    }
+    if (!conn.send_buffer.empty())
+    {
+      worker.ring->prepare_poll(conn.consfd, POLLOUT, tag(Writable, &conn));
+      conn.sending = true;
+      conn.inflight++;
+    }
+    return;
+  }
+
+  // all memory chunks in front go out with one sendmsg, like OutputQueue::flush()
+  std::memset(&conn.send_message, 0, sizeof(conn.send_message));
+  conn.send_message.msg_iov = conn.send_iov;
+  conn.send_message.msg_iovlen = conn.send_buffer.gather(conn.send_iov, OutputQueue::MAX_GATHER);
+  conn.send_started = std::chrono::steady_clock::now();
+  worker.ring->prepare_sendmsg(conn.consfd, &conn.send_message, MSG_NOSIGNAL, tag(Send, &conn));
+  conn.sending = true;
+  conn.inflight++;
+}
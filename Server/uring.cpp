@@ -0,0 +1,249 @@
+#include "uring.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// operations the io_uring event loop relies on, all available since Linux 5.6
+static const uint8_t REQUIRED_OPS[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_POLL_ADD, IORING_OP_TIMEOUT};
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+  return syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+template <typename T>
+static T *at(void *base, unsigned offset)
+{
+  return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+IoUring::IoUring(unsigned entries)
+{
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  ring_fd = io_uring_setup(entries, &params);
+  if (ring_fd == -1)
+  {
+    throw std::runtime_error("io_uring_setup failed: " + std::string(std::strerror(errno)));
+  }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    close(ring_fd);
+    throw std::runtime_error("io_uring without IORING_FEAT_SINGLE_MMAP (Linux < 5.4)");
+  }
+
+  rings_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+  rings = mmap(nullptr, rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes_memory = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (rings == MAP_FAILED || sqes_memory == MAP_FAILED)
+  {
+    int error = errno;
+    if (rings != MAP_FAILED)
+      munmap(rings, rings_size);
+    if (sqes_memory != MAP_FAILED)
+      munmap(sqes_memory, sqes_size);
+    close(ring_fd);
+    throw std::runtime_error("Unable to map the io_uring rings: " + std::string(std::strerror(error)));
+  }
+  sqes = static_cast<struct io_uring_sqe *>(sqes_memory);
+
+  sq_head = at<unsigned>(rings, params.sq_off.head);
+  sq_tail = at<unsigned>(rings, params.sq_off.tail);
+  sq_array = at<unsigned>(rings, params.sq_off.array);
+  sq_mask = *at<unsigned>(rings, params.sq_off.ring_mask);
+  sq_entries = *at<unsigned>(rings, params.sq_off.ring_entries);
+  sq_local_tail = *sq_tail;
+
+  cq_head = at<unsigned>(rings, params.cq_off.head);
+  cq_tail = at<unsigned>(rings, params.cq_off.tail);
+  cq_mask = *at<unsigned>(rings, params.cq_off.ring_mask);
+  cqes = at<struct io_uring_cqe>(rings, params.cq_off.cqes);
+}
+
+IoUring::~IoUring()
+{
+  munmap(sqes, sqes_size);
+  munmap(rings, rings_size);
+  close(ring_fd);
+}
+
+bool IoUring::supported(std::string &reason)
+{
+  try
+  {
+    IoUring ring(2);
+
+    // the probe ends in a flexible array of per-operation entries
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    std::unique_ptr<char[]> memory(new char[probe_size]());
+    struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe *>(memory.get());
+    if (io_uring_register(ring.ring_fd, IORING_REGISTER_PROBE, probe, 256) == -1)
+    {
+      reason = "no IORING_REGISTER_PROBE (Linux < 5.6)";
+      return false;
+    }
+    for (uint8_t op : REQUIRED_OPS)
+    {
+      if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+      {
+        reason = "operation " + std::to_string(op) + " not supported";
+        return false;
+      }
+    }
+    return true;
+  }
+  catch (const std::exception &e)
+  {
+    reason = e.what();
+    return false;
+  }
+}
+
+bool IoUring::sq_full() const
+{
+  return sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries;
+}
+
+struct io_uring_sqe *IoUring::next_sqe(uint8_t opcode, int fd, uint64_t user_data)
+{
+  // the slot at the tail still belongs to an unsubmitted entry while the ring is full
+  while (sq_full())
+  {
+    enter(0, 0);
+    if (!sq_full())
+    {
+      break;
+    }
+    // EBUSY/EAGAIN: the kernel wants completions reaped first. Set them aside
+    // for completions(), or wait for one if none has arrived yet.
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+    {
+      enter(1, IORING_ENTER_GETEVENTS);
+      continue;
+    }
+    for (; head != tail; head++)
+    {
+      set_aside.push_back(cqes[head & cq_mask]);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  unsigned index = sq_local_tail & sq_mask;
+  struct io_uring_sqe *sqe = &sqes[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+  sq_array[index] = index;
+  sq_local_tail++;
+  queued++;
+  return sqe;
+}
+
+void IoUring::prepare_accept(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = next_sqe(IORING_OP_ACCEPT, fd, user_data);
+  sqe->addr = reinterpret_cast<uintptr_t>(addr);
+  sqe->addr2 = reinterpret_cast<uintptr_t>(addrlen);
+  sqe->accept_flags = flags;
+}
+
+void IoUring::prepare_recv(int fd, void *buffer, size_t length, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = next_sqe(IORING_OP_RECV, fd, user_data);
+  sqe->addr = reinterpret_cast<uintptr_t>(buffer);
+  sqe->len = length;
+}
+
+void IoUring::prepare_sendmsg(int fd, const struct msghdr *message, int flags, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = next_sqe(IORING_OP_SENDMSG, fd, user_data);
+  sqe->addr = reinterpret_cast<uintptr_t>(message);
+  sqe->len = 1;
+  sqe->msg_flags = flags;
+}
+
+void IoUring::prepare_poll(int fd, short events, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = next_sqe(IORING_OP_POLL_ADD, fd, user_data);
+  sqe->poll32_events = events;
+}
+
+void IoUring::prepare_timeout(struct __kernel_timespec *timeout, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = next_sqe(IORING_OP_TIMEOUT, -1, user_data);
+  sqe->addr = reinterpret_cast<uintptr_t>(timeout);
+  sqe->len = 1;
+}
+
+void IoUring::enter(unsigned min_complete, unsigned flags)
+{
+  // the entries must be complete before the kernel sees the new tail
+  __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+  while (true)
+  {
+    int submitted = io_uring_enter(ring_fd, queued, min_complete, flags);
+    if (submitted >= 0)
+    {
+      queued -= submitted;
+      return;
+    }
+    if (errno == EBUSY || errno == EAGAIN)
+    {
+      return; // completions have to be reaped first, the entries stay queued
+    }
+    if (errno != EINTR)
+    {
+      throw std::runtime_error("io_uring_enter failed: " + std::string(std::strerror(errno)));
+    }
+  }
+}
+
+void IoUring::submit_and_wait()
+{
+  bool ready = !set_aside.empty() || __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) != *cq_head;
+  if (ready)
+  {
+    if (queued > 0)
+    {
+      enter(0, 0);
+    }
+    return;
+  }
+  enter(1, IORING_ENTER_GETEVENTS);
+}
+
+unsigned IoUring::completions(struct io_uring_cqe *out, unsigned max)
+{
+  unsigned count = std::min<size_t>(set_aside.size(), max);
+  std::copy(set_aside.begin(), set_aside.begin() + count, out);
+  set_aside.erase(set_aside.begin(), set_aside.begin() + count);
+
+  unsigned head = *cq_head;
+  unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail && count < max; head++, count++)
+  {
+    out[count] = cqes[head & cq_mask];
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  return count;
+}
@@ -0,0 +1,77 @@
+#ifndef URING_H
+#define URING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+// A single io_uring instance on top of the raw system calls, without liburing:
+// the submission and completion rings are mapped into the process and shared
+// with the kernel. Operations are queued with the prepare_* functions and all
+// go to the kernel with the next submit_and_wait(), so an event loop round
+// costs one io_uring_enter() however many sockets it touched.
+//
+// Every operation carries a user_data value that comes back in its completion.
+// Buffers and structures passed in must stay valid until then.
+class IoUring
+{
+public:
+    // Throws std::runtime_error if the kernel refuses the ring
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    // Whether this kernel has io_uring and every operation the event loop
+    // uses; otherwise reason says what is missing
+    static bool supported(std::string &reason);
+
+    void prepare_accept(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags, uint64_t user_data);
+    void prepare_recv(int fd, void *buffer, size_t length, uint64_t user_data);
+    void prepare_sendmsg(int fd, const struct msghdr *message, int flags, uint64_t user_data);
+    void prepare_poll(int fd, short events, uint64_t user_data);
+    // Completes with -ETIME once timeout has passed
+    void prepare_timeout(struct __kernel_timespec *timeout, uint64_t user_data);
+
+    // Submits everything prepared so far and waits for at least one
+    // completion, unless some are already waiting
+    void submit_and_wait();
+
+    // Takes up to max completions off the ring, like epoll_wait(); those set
+    // aside while the submission ring was full come first
+    unsigned completions(struct io_uring_cqe *out, unsigned max);
+
+private:
+    int ring_fd = -1;
+    void *rings = nullptr; // submission and completion ring in one mapping
+    size_t rings_size = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail; // entries up to here are prepared, published on submit
+    unsigned queued = 0;    // prepared and not yet submitted
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    std::vector<struct io_uring_cqe> set_aside; // reaped by next_sqe(), not handed out yet
+
+    // Blank entry for the next operation. A full ring is submitted first; if
+    // the kernel takes nothing, completions are set aside until it does.
+    struct io_uring_sqe *next_sqe(uint8_t opcode, int fd, uint64_t user_data);
+    void enter(unsigned min_complete, unsigned flags);
+    bool sq_full() const;
+};
+
+#endif // URING_H
@@ -0,0 +1,142 @@
+#include <csignal>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../Server/Auth/auth_cache.h"
+#include "../utils/log.h"
+
+// Checks the LRU bookkeeping of AuthCache through its public interface: a full
+// cache has to evict the entry used longest ago, also after hits and after
+// expired entries were unlinked from either end of the list. And that forked
+// handlers killed while holding the lock neither block the others nor leave
+// a broken table behind.
+//
+// Usage: ./auth-cache-check, exits with 1 if a check failed
+
+static int failures = 0;
+
+static const char *name_of(AuthCache::Result result)
+{
+    switch (result)
+    {
+    case AuthCache::Result::Accepted:
+        return "accepted";
+    case AuthCache::Result::Rejected:
+        return "rejected";
+    default:
+        return "miss";
+    }
+}
+
+static void expect(const std::string &check, AuthCache &cache, const std::string &user, AuthCache::Result expected)
+{
+    AuthCache::Result result = cache.lookup(user, "pw-" + user);
+    if (result != expected)
+    {
+        std::cout << "FAIL " << check << ": " << user << " is " << name_of(result) << ", expected " << name_of(expected) << "\n";
+        failures++;
+    }
+}
+
+// Two entries; rejections expire right away, so their next lookup unlinks them
+static AuthCacheConfig small_config()
+{
+    AuthCacheConfig config;
+    config.size = 2;
+    config.positive_ttl = 60;
+    config.negative_ttl = 0;
+    return config;
+}
+
+static void store(AuthCache &cache, const std::string &user, bool accepted = true)
+{
+    cache.store(user, "pw-" + user, accepted);
+}
+
+static void evict_after_hit()
+{
+    AuthCache cache(small_config());
+    store(cache, "a");
+    store(cache, "b");
+    expect("evict after hit", cache, "a", AuthCache::Result::Accepted); // b is the oldest now
+    store(cache, "c");
+    expect("evict after hit", cache, "a", AuthCache::Result::Accepted);
+    expect("evict after hit", cache, "b", AuthCache::Result::Miss);
+    expect("evict after hit", cache, "c", AuthCache::Result::Accepted);
+}
+
+static void unlink_newest()
+{
+    AuthCache cache(small_config());
+    store(cache, "a");
+    store(cache, "x", false);
+    expect("unlink newest", cache, "x", AuthCache::Result::Miss); // expired, unlinked from the head
+    store(cache, "b");
+    store(cache, "c"); // evicts a
+    store(cache, "d"); // evicts b
+    expect("unlink newest", cache, "a", AuthCache::Result::Miss);
+    expect("unlink newest", cache, "b", AuthCache::Result::Miss);
+    expect("unlink newest", cache, "c", AuthCache::Result::Accepted);
+    expect("unlink newest", cache, "d", AuthCache::Result::Accepted);
+}
+
+static void unlink_oldest()
+{
+    AuthCache cache(small_config());
+    store(cache, "x", false);
+    store(cache, "a");
+    expect("unlink oldest", cache, "x", AuthCache::Result::Miss); // expired, unlinked from the tail
+    store(cache, "b");
+    store(cache, "c"); // evicts a
+    expect("unlink oldest", cache, "a", AuthCache::Result::Miss);
+    expect("unlink oldest", cache, "b", AuthCache::Result::Accepted);
+    expect("unlink oldest", cache, "c", AuthCache::Result::Accepted);
+}
+
+// Children look up unknown users in a loop, which is mostly time under the
+// lock, and are killed at a random point
+static void killed_holder()
+{
+    AuthCache cache(small_config());
+    store(cache, "a");
+    for (int round = 0; round < 50; round++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            for (;;)
+            {
+                cache.lookup("nobody", "pw");
+            }
+        }
+        usleep(1000 + round * 100);
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+
+        // a lock left held by the child blocks for good, the alarm ends the check
+        alarm(5);
+        store(cache, "b");
+        expect("killed holder", cache, "b", AuthCache::Result::Accepted);
+        alarm(0);
+    }
+}
+
+int main()
+{
+    // the warning about the cleared cache is expected here
+    Log::threshold = LogLevel::Error;
+
+    evict_after_hit();
+    unlink_newest();
+    unlink_oldest();
+    killed_holder();
+
+    if (failures > 0)
+    {
+        std::cout << failures << " auth cache checks failed\n";
+        return 1;
+    }
+    std::cout << "auth cache checks passed\n";
+    return 0;
+}
@@ -0,0 +1,421 @@
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include "../Server/MailManager/mailbox_index.h"
+#include "../Server/MailManager/mailbox_segment.h"
+#include "../Server/MailManager/segment_mail_store.h"
+#include "../utils/log.h"
+
+// Checks the mailbox files: MailboxSegment and MailboxIndex views across many
+// compactions and after an interrupted append, and SegmentMailStore the way the
+// server drives it, a maintenance thread compacting while the fork-per-connection
+// server runs SEND and DEL in children. Works in temporary spool directories
+// that are removed afterwards.
+//
+// Usage: ./mail-store-check, exits with 1 if a check failed
+
+static int failures = 0;
+
+static void fail(const std::string &check, const std::string &message)
+{
+    std::cout << "FAIL " << check << ": " << message << "\n";
+    failures++;
+}
+
+static fs::path make_spool()
+{
+    char path[] = "/tmp/twmailer-check-XXXXXX";
+    if (mkdtemp(path) == nullptr)
+    {
+        throw std::runtime_error("Unable to create a temporary spool directory");
+    }
+    return path;
+}
+
+static std::string body(size_t length, char fill)
+{
+    std::string content(length - 1, fill);
+    content.push_back('\n');
+    return content;
+}
+
+// One connection: SEND a message, then DEL the oldest one. A lock inherited
+// from the compactor would block the child for good, the alarm ends it.
+static void connection(SegmentMailStore &store)
+{
+    alarm(5);
+    std::string subject = "connection " + std::to_string(getpid());
+    std::pmr::vector<MessageInfo> messages;
+    if (!store.append("bob", "alice", subject, body(8192, 'x')) || !store.list("bob", messages))
+    {
+        _exit(1);
+    }
+    for (const MessageInfo &message : messages)
+    {
+        if (std::string_view(message.subject) == subject)
+        {
+            _exit(store.remove("bob", message.id) ? 0 : 1);
+        }
+    }
+    _exit(1);
+}
+
+static void fork_during_compaction()
+{
+    const int CONNECTIONS = 400;
+    const int PARALLEL = 4;
+    const int KEPT = 16;
+
+    fs::path spool = make_spool();
+    SegmentMailStore store(spool, Durability::None);
+    for (int i = 0; i < KEPT; i++)
+    {
+        store.append("bob", "alice", "check", body(8192, 'k'));
+    }
+
+    std::atomic<bool> stop(false);
+    std::thread compactor([&]
+    {
+        while (!stop.load())
+        {
+            store.maintain();
+        }
+    });
+
+    int started = 0;
+    int running = 0;
+    while (started < CONNECTIONS || running > 0)
+    {
+        if (started < CONNECTIONS && running < PARALLEL)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                connection(store);
+            }
+            if (pid == -1)
+            {
+                fail("fork during compaction", "fork() failed");
+                break;
+            }
+            started++;
+            running++;
+            continue;
+        }
+
+        int status;
+        if (wait(&status) == -1)
+        {
+            break;
+        }
+        running--;
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM)
+        {
+            fail("fork during compaction", "a child blocked on a mailbox lock");
+        }
+        else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fail("fork during compaction", "SEND or DEL failed in a child");
+        }
+    }
+    stop.store(true);
+    compactor.join();
+
+    // every connection added one message and deleted one
+    std::pmr::vector<MessageInfo> messages;
+    if (!store.list("bob", messages) || messages.size() != KEPT)
+    {
+        fail("fork during compaction", std::to_string(messages.size()) + " messages left, expected " + std::to_string(KEPT));
+    }
+    struct stat segment;
+    if (stat((spool / "bob" / "mailbox.seg").c_str(), &segment) == -1 || segment.st_size >= CONNECTIONS * 8192)
+    {
+        fail("fork during compaction", "the segment was never compacted");
+    }
+    fs::remove_all(spool);
+}
+
+// Writes the first bytes of a record whose length runs past the end of the file,
+// returns the file size after it
+static uintmax_t append_partial_record(const std::string &check, const fs::path &path)
+{
+    std::string partial(30, '\0');
+    partial[0] = 100;
+    partial[1] = 1;
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+    if (fd == -1 || write(fd, partial.data(), partial.size()) != static_cast<ssize_t>(partial.size()))
+    {
+        fail(check, "unable to write the partial record");
+    }
+    close(fd);
+    return fs::file_size(path);
+}
+
+static std::string message_body(uint64_t id)
+{
+    return body(1000 + id * 37 % 3000, 'a' + id % 26);
+}
+
+// The live messages of view have to be exactly the expected ones, with their content
+static void verify_segment(const std::string &check, MailboxSegment &segment, MailboxView &view, const std::map<uint64_t, std::string> &expected)
+{
+    if (!segment.refresh(view))
+    {
+        fail(check, "refresh failed");
+        return;
+    }
+
+    std::map<uint64_t, std::string> found;
+    for (const IndexEntry &entry : view.entries)
+    {
+        if (entry.deleted)
+            continue;
+        found[entry.id] = entry.subject;
+
+        std::string content(entry.content_length, '\0');
+        if (!segment.read(entry, &content[0]) || content != message_body(entry.id))
+        {
+            fail(check, "content of message " + std::to_string(entry.id) + " differs");
+        }
+    }
+    if (found != expected || view.live_count != expected.size())
+    {
+        fail(check, std::to_string(found.size()) + " messages listed, expected " + std::to_string(expected.size()) + (found.size() == expected.size() ? " other ones" : ""));
+    }
+}
+
+// A view that is refreshed only now and then has to notice every compaction,
+// also when the compacted file got the inode and size of an older one.
+// Refreshed after 2, 3 and 1 rounds in turn, whatever the file system's
+// pattern of reusing inodes.
+static bool stale_round(int round)
+{
+    return round % 6 == 1 || round % 6 == 4 || round % 6 == 5;
+}
+
+static void segment_compaction()
+{
+    const std::string CHECK = "segment compaction";
+    fs::path spool = make_spool();
+    fs::create_directories(spool / "bob");
+    MailboxSegment segment(spool / "bob");
+
+    MailboxView writer; // refreshed before every change, as the store does under its lock
+    MailboxView reader; // sees several compactions at once
+    std::map<uint64_t, std::string> expected;
+    for (int round = 0; round < 300 && failures == 0; round++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            segment.refresh(writer);
+            uint64_t id = writer.max_id + 1;
+            std::string subject = "message " + std::to_string(id);
+            if (!segment.append(writer, id, "alice", subject, message_body(id), std::time(nullptr)))
+            {
+                fail(CHECK, "append failed");
+            }
+            expected[id] = subject;
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            segment.refresh(writer);
+            if (!segment.remove(writer, expected.begin()->first))
+            {
+                fail(CHECK, "remove failed");
+            }
+            expected.erase(expected.begin());
+        }
+        segment.refresh(writer);
+        if (!segment.compact(writer))
+        {
+            fail(CHECK, "compaction failed");
+        }
+        if (stale_round(round))
+        {
+            verify_segment(CHECK, segment, reader, expected);
+        }
+    }
+    MailboxView fresh;
+    verify_segment(CHECK, segment, fresh, expected);
+    fs::remove_all(spool);
+}
+
+// A record cut short by a crash is skipped by readers and only cut off by the next append
+static void segment_torn_append()
+{
+    const std::string CHECK = "segment torn append";
+    fs::path spool = make_spool();
+    fs::create_directories(spool / "bob");
+    MailboxSegment segment(spool / "bob");
+    fs::path segment_path = spool / "bob" / "mailbox.seg";
+
+    MailboxView view;
+    std::map<uint64_t, std::string> expected;
+    for (uint64_t id = 1; id <= 3; id++)
+    {
+        segment.append(view, id, "alice", "message " + std::to_string(id), message_body(id), std::time(nullptr));
+        expected[id] = "message " + std::to_string(id);
+    }
+
+    uintmax_t torn_size = append_partial_record(CHECK, segment_path);
+
+    MailboxView reader;
+    verify_segment(CHECK, segment, reader, expected);
+    if (fs::file_size(segment_path) != torn_size)
+    {
+        fail(CHECK, "refresh changed the segment");
+    }
+
+    segment.refresh(view);
+    if (!segment.append(view, 4, "alice", "message 4", message_body(4), std::time(nullptr)))
+    {
+        fail(CHECK, "append after the partial record failed");
+    }
+    expected[4] = "message 4";
+    verify_segment(CHECK, segment, reader, expected);
+    MailboxView fresh;
+    verify_segment(CHECK, segment, fresh, expected);
+    fs::remove_all(spool);
+}
+
+static std::string file_name(uint64_t id)
+{
+    return std::to_string(id) + "-0_alice.txt";
+}
+
+// The live entries of view have to be exactly the expected ones
+static void verify_index(const std::string &check, MailboxIndex &index, MailboxView &view, const std::map<uint64_t, std::string> &expected)
+{
+    if (!index.refresh(view))
+    {
+        fail(check, "refresh failed");
+        return;
+    }
+
+    std::map<uint64_t, std::string> found;
+    for (const IndexEntry &entry : view.entries)
+    {
+        if (entry.deleted)
+            continue;
+        found[entry.id] = entry.subject;
+        if (entry.file_name != file_name(entry.id))
+        {
+            fail(check, "file name of message " + std::to_string(entry.id) + " differs");
+        }
+    }
+    if (found != expected || view.live_count != expected.size())
+    {
+        fail(check, std::to_string(found.size()) + " messages listed, expected " + std::to_string(expected.size()) + (found.size() == expected.size() ? " other ones" : ""));
+    }
+}
+
+// The index compacts itself once tombstones outnumber the live entries: every
+// round here, with 20 live entries and up to 76 deleted ones
+static void index_compaction()
+{
+    const std::string CHECK = "index compaction";
+    fs::path spool = make_spool();
+    fs::create_directories(spool / "bob");
+    MailboxIndex index(spool / "bob");
+
+    MailboxView writer;
+    MailboxView reader;
+    std::map<uint64_t, std::string> expected;
+    for (int round = 0; round < 300 && failures == 0; round++)
+    {
+        int added = 70 + round % 7;
+        for (int i = 0; i < (round == 0 ? added + 20 : added); i++)
+        {
+            index.refresh(writer);
+            uint64_t id = writer.max_id + 1;
+            std::string subject = "message " + std::to_string(id);
+            if (!index.append(writer, id, "alice", subject, file_name(id), std::time(nullptr)))
+            {
+                fail(CHECK, "append failed");
+            }
+            expected[id] = subject;
+        }
+        for (int i = 0; i < added; i++)
+        {
+            index.refresh(writer);
+            if (!index.remove(writer, expected.begin()->first))
+            {
+                fail(CHECK, "remove failed");
+            }
+            expected.erase(expected.begin());
+        }
+        if (stale_round(round))
+        {
+            verify_index(CHECK, index, reader, expected);
+        }
+    }
+    MailboxView fresh;
+    verify_index(CHECK, index, fresh, expected);
+    fs::remove_all(spool);
+}
+
+static void index_torn_append()
+{
+    const std::string CHECK = "index torn append";
+    fs::path spool = make_spool();
+    fs::create_directories(spool / "bob");
+    MailboxIndex index(spool / "bob");
+    fs::path index_path = spool / "bob" / ".index";
+
+    MailboxView view;
+    std::map<uint64_t, std::string> expected;
+    index.refresh(view);
+    for (uint64_t id = 1; id <= 3; id++)
+    {
+        index.append(view, id, "alice", "message " + std::to_string(id), file_name(id), std::time(nullptr));
+        expected[id] = "message " + std::to_string(id);
+    }
+    uintmax_t torn_size = append_partial_record(CHECK, index_path);
+
+    MailboxView reader;
+    verify_index(CHECK, index, reader, expected);
+    if (fs::file_size(index_path) != torn_size)
+    {
+        fail(CHECK, "refresh changed the index");
+    }
+
+    index.refresh(view);
+    if (!index.append(view, 4, "alice", "message 4", file_name(4), std::time(nullptr)))
+    {
+        fail(CHECK, "append after the partial record failed");
+    }
+    expected[4] = "message 4";
+    verify_index(CHECK, index, reader, expected);
+    MailboxView fresh;
+    verify_index(CHECK, index, fresh, expected);
+    fs::remove_all(spool);
+}
+
+int main()
+{
+    // one line per compaction and the warnings about the damage done on purpose are noise here
+    Log::threshold = LogLevel::Error;
+    segment_compaction();
+    segment_torn_append();
+    index_compaction();
+    index_torn_append();
+    fork_during_compaction();
+
+    if (failures > 0)
+    {
+        std::cout << failures << " mail store checks failed\n";
+        return 1;
+    }
+    std::cout << "mail store checks passed\n";
+    return 0;
+}
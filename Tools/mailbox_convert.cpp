@@ -0,0 +1,201 @@
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../Server/MailManager/mailbox_index.h"
+#include "../Server/MailManager/mailbox_segment.h"
+#include "../Server/MailManager/record_io.h"
+
+// Converts every inbox of a mail spool between the directory layout (one file
+// per message + .index) and the segment layout (one mailbox.seg per inbox).
+// Message ids are kept, so numbers shown by LIST stay valid.
+//
+// Each inbox is written to a staging directory next to it, synced and swapped
+// in with rename(). The original is only removed once the renames are on disk,
+// so an interrupted run or a crash leaves at least one complete copy. The
+// server must not run while converting.
+//
+// Usage: ./twmailer-convert <mail-spool-directoryname> <dir|segment>
+
+namespace fs = std::filesystem;
+
+static bool read_file(const fs::path &path, std::string &content)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    content = buffer.str();
+    return true;
+}
+
+static bool write_file(const fs::path &path, const std::string &content)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        return false;
+    }
+    bool written = write_all(fd, content) && fdatasync(fd) == 0;
+    return close(fd) == 0 && written;
+}
+
+// The segment or index is synced once after its last record instead of after every append
+static bool sync_file(const fs::path &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return errno == ENOENT; // an inbox without messages has no segment
+    }
+    bool synced = fdatasync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+static bool to_segment(const fs::path &user_inbox, const fs::path &staging)
+{
+    MailboxView source;
+    if (!MailboxIndex(user_inbox).refresh(source))
+    {
+        return false;
+    }
+
+    MailboxSegment segment(staging);
+    MailboxView target;
+    std::string content;
+    for (const auto &entry : source.entries)
+    {
+        if (entry.deleted)
+        {
+            continue;
+        }
+        if (!read_file(user_inbox / entry.file_name, content) ||
+            !segment.append(target, entry.id, entry.sender, entry.subject, content, entry.timestamp))
+        {
+            std::cout << "Unable to convert message " << entry.id << " in " << user_inbox << "\n";
+            return false;
+        }
+    }
+
+    // a deleted highest id is kept as a tombstone so it is never handed out again
+    if (source.max_id > target.max_id &&
+        !(segment.append(target, source.max_id, "", "", "", std::time(nullptr)) && segment.remove(target, source.max_id)))
+    {
+        return false;
+    }
+    return sync_file(staging / "mailbox.seg");
+}
+
+static bool to_directory(const fs::path &user_inbox, const fs::path &staging)
+{
+    MailboxView source;
+    MailboxSegment segment(user_inbox);
+    if (!segment.refresh(source))
+    {
+        return false;
+    }
+
+    MailboxIndex index(staging);
+    MailboxView target;
+    if (!index.refresh(target))
+    {
+        return false;
+    }
+
+    std::string content;
+    for (const auto &entry : source.entries)
+    {
+        if (entry.deleted)
+        {
+            continue;
+        }
+        std::string file_name = std::to_string(entry.id) + "-" + std::to_string(entry.timestamp) + "_" + entry.sender + ".txt";
+        content.resize(entry.content_length);
+        if (!segment.read(entry, &content[0]) || !write_file(staging / file_name, content) ||
+            !index.append(target, entry.id, entry.sender, entry.subject, file_name, entry.timestamp))
+        {
+            std::cout << "Unable to convert message " << entry.id << " in " << user_inbox << "\n";
+            return false;
+        }
+    }
+
+    if (source.max_id > target.max_id &&
+        !(index.append(target, source.max_id, "", "", "", std::time(nullptr)) && index.remove(target, source.max_id)))
+    {
+        return false;
+    }
+    return sync_file(staging / ".index");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3 || (std::string(argv[2]) != "dir" && std::string(argv[2]) != "segment"))
+    {
+        std::cout << "Usage: ./twmailer-convert <mail-spool-directoryname> <dir|segment>\n";
+        return EXIT_FAILURE;
+    }
+
+    fs::path mail_directory(argv[1]);
+    bool want_segment = std::string(argv[2]) == "segment";
+    int converted = 0;
+    int failed = 0;
+
+    // inboxes are renamed below, so the list is taken before the first one is touched
+    std::vector<std::string> users;
+    for (const auto &dir_entry : fs::directory_iterator(mail_directory))
+    {
+        std::string user = dir_entry.path().filename().string();
+        if (dir_entry.is_directory() && user[0] != '.')
+        {
+            users.push_back(user);
+        }
+    }
+
+    for (const auto &user : users)
+    {
+        fs::path user_inbox = mail_directory / user;
+        if (MailboxSegment::exists(user_inbox) == want_segment)
+        {
+            continue; // already in the requested layout
+        }
+
+        fs::path staging = mail_directory / (".convert-" + user);
+        fs::path previous = mail_directory / (".previous-" + user);
+        fs::remove_all(staging);
+        fs::create_directories(staging);
+
+        bool ok = want_segment ? to_segment(user_inbox, staging) : to_directory(user_inbox, staging);
+        if (!ok || !sync_directory(staging))
+        {
+            fs::remove_all(staging);
+            failed++;
+            continue;
+        }
+
+        fs::rename(user_inbox, previous);
+        fs::rename(staging, user_inbox);
+        if (!sync_directory(mail_directory))
+        {
+            // both copies stay, the old one under its .previous- name
+            std::cout << "Unable to sync " << mail_directory << ", kept " << previous << "\n";
+            failed++;
+            continue;
+        }
+        fs::remove_all(previous);
+        converted++;
+    }
+
+    std::cout << "Converted " << converted << " inboxes to the " << argv[2] << " layout";
+    if (failed > 0)
+    {
+        std::cout << ", " << failed << " failed";
+    }
+    std::cout << "\n";
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
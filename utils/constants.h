@@ -1,21 +1,82 @@
 #ifndef CONSTANTS_H
 #define CONSTANTS_H
 
+#include <cstddef>
+#include <sys/types.h>
+
 namespace GenericConstants
 {
     constexpr ssize_t STD_BUFFER_SIZE = 64;
+
+    // Framing
+    constexpr size_t MAX_HEADER_LENGTH = 1024;                 // command + content-length line
+    constexpr size_t MAX_CONTENT_LENGTH = 64 * 1024 * 1024;    // larger bodies are rejected as invalid
+
+    // Logging
+    constexpr size_t LOG_RING_RECORDS = 1024; // per thread, further records are dropped until the writer catches up
+    constexpr size_t LOG_RECORD_SIZE = 240;   // text bytes per record, longer messages are cut
+    constexpr int LOG_FLUSH_INTERVAL = 100;   // in ms between writes of the buffered records
+}
+namespace ClientConstants
+{
+    // Batch mode
+    constexpr size_t BATCH_SEND_AHEAD = 256 * 1024; // bytes of requests sent ahead of their replies
+    constexpr size_t RECV_CHUNK_SIZE = 16384;
 }
 namespace ServerConstants
 {
     constexpr int MAX_PENDING_CONNECTIONS = 6;
     constexpr int MAX_LOGIN_ATTEMPTS = 3;
 
+    // Admission control right after accept
+    constexpr size_t MAX_CONNECTIONS = 1024;        // open at once
+    constexpr size_t MAX_CONNECTIONS_PER_IP = 128;  // open at once per source IP
+    constexpr double IP_CONNECT_RATE = 50;          // new connections per sec and source IP
+    constexpr double IP_CONNECT_BURST = 100;
+    constexpr size_t MAX_TRACKED_SOURCES = 65536;   // hard cap, the least recently used idle source IP is forgotten first
+
+    // Reactor
+    constexpr int MAX_EPOLL_EVENTS = 256;
+    constexpr size_t RECV_CHUNK_SIZE = 16384;
+    constexpr size_t MAX_PENDING_OUTPUT = 1024 * 1024; // stop reading requests while more replies are unsent
+    constexpr size_t SENDFILE_MIN_LENGTH = 16 * 1024;   // smaller messages in READ replies are copied instead
+    constexpr unsigned int WORKER_STATS_INTERVAL = 30; // in sec
+    constexpr unsigned int URING_ENTRIES = 1024;       // submission queue size of each io_uring
+    constexpr size_t URING_MAX_BUFFERED_INPUT = 1024 * 1024; // stop receiving while this much waits for a send
+
+    // Metrics endpoint
+    constexpr int METRICS_SCRAPE_TIMEOUT = 2; // in sec per scrape request
+
+    // Per-connection request arena
+    constexpr size_t REQUEST_ARENA_BLOCK_SIZE = 16 * 1024;    // first block, later ones double
+    constexpr size_t REQUEST_ARENA_MAX_RETAINED = 1024 * 1024; // larger arenas are given back after the request
+
     // LDAP
     constexpr const char *HOST_URL = "ldap://ldap.technikum-wien.at:389";
+    constexpr const char *LDAP_BASE_DN = "ou=People,dc=technikum-wien,dc=at";
     constexpr int DESIRED_LDAP_VERSION = 3; // from ldap.h LDAP_VERSION_3 enum
+    constexpr size_t LDAP_POOL_SIZE = 8;          // directory connections per process
+    constexpr int LDAP_NETWORK_TIMEOUT = 5;       // in sec
+    constexpr int LDAP_OPERATION_TIMEOUT = 5;     // in sec
+    constexpr int LDAP_ACQUIRE_TIMEOUT = 5;       // in sec
+    constexpr int LDAP_MAX_IDLE = 300;            // in sec
+    constexpr int LOGIN_POLL_INTERVAL = 50;       // in ms, reactor retries for a free LDAP handle
+
+    // Authentication cache
+    constexpr size_t AUTH_CACHE_SIZE = 4096;        // entries shared by all handlers
+    constexpr int AUTH_CACHE_TTL = 300;             // in sec
+    constexpr int AUTH_CACHE_NEGATIVE_TTL = 30;     // in sec
+    constexpr int AUTH_HASH_THREADS = 2;            // event loops: cache lookups and stores hash on these
+    constexpr int AUTH_CACHE_HASH_ROUNDS = 5000;    // SHA-512 crypt rounds per cached password
+
+    // Mail storage
+    constexpr size_t MAX_CACHED_MAILBOXES = 4096; // index views kept in memory per process
+    constexpr unsigned int STORE_MAINTENANCE_INTERVAL = 60;        // in sec, segment compaction
+    constexpr size_t SEGMENT_COMPACT_MIN_DEAD_BYTES = 64 * 1024;   // and at least half of the segment
 
     // Blacklist
     constexpr int BLACKLIST_TIMEOUT = 60; // in sec
+    constexpr unsigned int BLACKLIST_CLEANUP_INTERVAL = 5; // in sec, frees expired entries
     
     // Responses
     constexpr const char* RESPONSE_OK = "OK\n";
@@ -0,0 +1,136 @@
+#include "frame_parser.h"
+#include <charconv>
+#include <cstring>
+#include "constants.h"
+
+static constexpr std::string_view CONTENT_LENGTH_PREFIX = "Content-Length:";
+
+// Parses "Content-Length: <n>" without allocating, surrounding blanks are ignored
+static bool parse_content_length(std::string_view header, size_t &content_length)
+{
+  if (header.substr(0, CONTENT_LENGTH_PREFIX.size()) != CONTENT_LENGTH_PREFIX)
+  {
+    return false;
+  }
+  header.remove_prefix(CONTENT_LENGTH_PREFIX.size());
+
+  size_t first = header.find_first_not_of(" \t");
+  size_t last = header.find_last_not_of(" \t\r");
+  if (first == std::string_view::npos)
+  {
+    return false;
+  }
+  header = header.substr(first, last - first + 1);
+
+  auto result = std::from_chars(header.data(), header.data() + header.size(), content_length);
+  return result.ec == std::errc() && result.ptr == header.data() + header.size();
+}
+
+FrameParser::FrameParser(bool with_command_line, size_t initial_capacity)
+: with_command_line(with_command_line)
+, buffer(new char[initial_capacity])
+, capacity(initial_capacity)
+{}
+
+FrameParser::~FrameParser()
+{
+  delete[] buffer;
+}
+
+char *FrameParser::write_ptr(size_t min_free)
+{
+  if (read_pos == write_pos)
+  {
+    // drained: wrap around to the start for free
+    read_pos = write_pos = 0;
+  }
+
+  if (capacity - write_pos < min_free)
+  {
+    size_t pending = buffered();
+    if (capacity - pending >= min_free && read_pos > 0)
+    {
+      // enough room once the unparsed tail is moved to the front
+      std::memmove(buffer, buffer + read_pos, pending);
+    }
+    else
+    {
+      size_t new_capacity = capacity * 2;
+      while (new_capacity - pending < min_free)
+      {
+        new_capacity *= 2;
+      }
+      char *new_buffer = new char[new_capacity];
+      std::memcpy(new_buffer, buffer + read_pos, pending);
+      delete[] buffer;
+      buffer = new_buffer;
+      capacity = new_capacity;
+    }
+    read_pos = 0;
+    write_pos = pending;
+  }
+
+  return buffer + write_pos;
+}
+
+size_t FrameParser::writable() const
+{
+  return capacity - write_pos;
+}
+
+void FrameParser::commit(size_t written)
+{
+  write_pos += written;
+}
+
+void FrameParser::feed(const char *data, size_t length)
+{
+  std::memcpy(write_ptr(length), data, length);
+  commit(length);
+}
+
+FrameParser::Status FrameParser::next(Frame &frame)
+{
+  std::string_view pending(buffer + read_pos, buffered());
+
+  size_t header_start = 0;
+  if (with_command_line)
+  {
+    size_t command_end = pending.find('\n');
+    if (command_end == std::string_view::npos)
+    {
+      return pending.size() > GenericConstants::MAX_HEADER_LENGTH ? Status::Invalid : Status::NeedMore;
+    }
+    frame.command = pending.substr(0, command_end);
+    header_start = command_end + 1;
+  }
+  else
+  {
+    frame.command = std::string_view();
+  }
+
+  size_t header_end = pending.find('\n', header_start);
+  if (header_end == std::string_view::npos)
+  {
+    return pending.size() > GenericConstants::MAX_HEADER_LENGTH ? Status::Invalid : Status::NeedMore;
+  }
+
+  size_t content_length;
+  if (!parse_content_length(pending.substr(header_start, header_end - header_start), content_length) ||
+      content_length > GenericConstants::MAX_CONTENT_LENGTH)
+  {
+    return Status::Invalid;
+  }
+
+  size_t body_start = header_end + 1;
+  if (pending.size() - body_start < content_length)
+  {
+    return Status::NeedMore;
+  }
+
+  frame.content_length = content_length;
+  frame.body = pending.substr(body_start, content_length);
+  frame.raw = pending.substr(0, body_start + content_length);
+  read_pos += frame.raw.size();
+  return Status::Complete;
+}
@@ -0,0 +1,62 @@
+#ifndef FRAME_PARSER_H
+#define FRAME_PARSER_H
+
+#include <cstddef>
+#include <string_view>
+
+// One complete protocol frame. All views point into the parser's buffer and stay
+// valid until the next call to write_ptr() or feed().
+struct Frame
+{
+    std::string_view command; // first line, empty for server responses
+    size_t content_length = 0;
+    std::string_view body;    // exactly content_length bytes
+    std::string_view raw;     // command line + header + body
+};
+
+// Incremental parser for "[<command>\n]Content-Length: <n>\n<body>" frames.
+// Bytes can be fed in arbitrary chunks, several pipelined frames in one chunk are
+// returned one after another by next(). Requests carry a command line, responses
+// from the server start directly with the Content-Length header.
+//
+// The bytes live in a growable ring buffer. Unparsed data is kept contiguous so
+// frames can be handed out as string_views: the read position wraps back to the
+// start whenever the buffer drains, and the remaining bytes are only moved when
+// a write would not fit behind them.
+class FrameParser
+{
+public:
+    enum class Status
+    {
+        Complete, // frame was filled in
+        NeedMore, // no complete frame buffered yet
+        Invalid   // malformed header, the stream can not be resynchronised
+    };
+
+    explicit FrameParser(bool with_command_line = true, size_t initial_capacity = 4096);
+    ~FrameParser();
+
+    FrameParser(const FrameParser &) = delete;
+    FrameParser &operator=(const FrameParser &) = delete;
+
+    // Returns at least min_free writable bytes to recv() into, followed by commit()
+    char *write_ptr(size_t min_free);
+    size_t writable() const;
+    void commit(size_t written);
+
+    // Copies a chunk into the buffer, for callers that already hold the bytes
+    void feed(const char *data, size_t length);
+
+    Status next(Frame &frame);
+
+    size_t buffered() const { return write_pos - read_pos; }
+
+private:
+    bool with_command_line;
+    char *buffer;
+    size_t capacity;
+    size_t read_pos = 0;  // start of the first unparsed byte
+    size_t write_pos = 0; // end of the received bytes
+};
+
+#endif // FRAME_PARSER_H
@@ -2,6 +2,7 @@
 #include <termios.h>
 #include <unistd.h>
 #include <cstring>
+#include <cerrno>
 #include <sys/socket.h>
 #include <sys/types.h>
 
@@ -25,65 +26,30 @@ void get_hidden_user_input(const std::string &prompt, std::string &buffer)
   std::cout << "\n";
 }
 
-void resize_buffer(char *&buffer, ssize_t &current_size, ssize_t new_capacity)
+void append_server_response(OutputQueue &out, const void *buffer, size_t __n)
 {
-  if (new_capacity <= current_size)
-  {
-    return; // No resizing needed if the new size is smaller or equal
-  }
-
-  // Allocate new memory
-  char *newBuffer = new char[new_capacity];
-
-  // Copy old data into the new buffer
-  std::memcpy(newBuffer, buffer, current_size);
-
-  // Free the old buffer
-  delete[] buffer;
-
-  // Update the buffer pointer and size
-  buffer = newBuffer;
-  current_size = new_capacity;
-}
-
-void send_server_response(int __fd, const void *buffer, size_t __n, int __flags)
-{
-  // add content length header at top
-  int content_length = __n;
-  std::string header_and_body = "Content-Length: " + std::to_string(content_length) + "\n";
-  header_and_body.append(static_cast<const char *>(buffer), __n);
-  // then send with send cmd
-  send(__fd, header_and_body.c_str(), header_and_body.size(), __flags);
+  // content length header at top, then the body
+  ResponseWriter(out, __n).write(std::string_view(static_cast<const char *>(buffer), __n));
 }
 
-bool check_content_length_header(std::string &content_length_header, int &content_length)
+bool next_line(std::string_view &rest, std::string_view &line)
 {
-  if (content_length_header.rfind("Content-Length:", 0) == 0) // Starts with "content-length:"
+  if (rest.empty())
   {
-    // get the actual length
-    std::string lengthStr = content_length_header.substr(15);
-    lengthStr.erase(0, lengthStr.find_first_not_of(" \t")); // Trim leading spaces
-    lengthStr.erase(lengthStr.find_last_not_of(" \t") + 1);
+    return false;
+  }
 
-    try
-    {
-      content_length = std::stoul(lengthStr); // Convert to size_t
-    }
-    catch (const std::invalid_argument &)
-    {
-      std::cout << "Invalid content-length value." << std::endl;
-      return false;
-    }
-    catch (const std::out_of_range &)
-    {
-      std::cout << "Content-length value out of range." << std::endl;
-      return false;
-    }
+  size_t end = rest.find('\n');
+  if (end == std::string_view::npos)
+  {
+    // last line without terminator
+    line = rest;
+    rest = std::string_view();
   }
   else
   {
-    std::cout << "Invalid format" << std::endl;
-    return false;
+    line = rest.substr(0, end);
+    rest.remove_prefix(end + 1);
   }
   return true;
-}
\ No newline at end of file
+}
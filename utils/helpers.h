@@ -2,15 +2,18 @@
 #define HELPERS_H
 #include <iostream>
 #include <string>
+#include <string_view>
+#include "response_writer.h"
 
 // get input from user
 void get_user_input(const std::string& prompt, std::string& buffer);
 void get_hidden_user_input(const std::string& prompt, std::string& buffer);
 
-void resize_buffer(char *&buffer, ssize_t &current_size, ssize_t new_capacity);
+// queue one framed reply (Content-Length header + body) behind the pending ones;
+// replies made of several parts use ResponseWriter directly
+void append_server_response(OutputQueue &out, const void *buffer, size_t __n);
 
-void send_server_response(int __fd, const void *buffer, size_t __n, int __flags);
-
-bool check_content_length_header(std::string &content_length_header, int &content_length);
+// split off the next '\n'-terminated line of a frame body without copying
+bool next_line(std::string_view &rest, std::string_view &line);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,342 @@
+#include "log.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <pthread.h>
+#include <streambuf>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "constants.h"
+
+static const char *LEVEL_NAMES[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+namespace
+{
+  struct Record
+  {
+    int64_t time; // in ns since the epoch
+    LogLevel level;
+    uint16_t length;
+    char text[GenericConstants::LOG_RECORD_SIZE];
+  };
+
+  // Written only by the owning thread, read only by the writer
+  struct Ring
+  {
+    Record records[GenericConstants::LOG_RING_RECORDS];
+    std::atomic<uint64_t> head{0}; // next record for the writer
+    std::atomic<uint64_t> tail{0}; // next free slot
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> orphaned{false}; // the thread ended, freed once drained
+  };
+
+  struct Logger
+  {
+    std::mutex mutex; // guards rings, taken by the writer and by a thread's first record
+    std::vector<Ring *> rings;
+    std::atomic<bool> started{false};
+    bool stopping = false;
+    std::condition_variable wake;
+    std::thread *writer = nullptr; // a forked child replaces it without touching the parent's
+    int fd = STDOUT_FILENO;
+  };
+
+  // never destroyed: detached threads may still log while the process exits
+  Logger &logger()
+  {
+    static Logger *instance = new Logger();
+    return *instance;
+  }
+
+  // Hands the ring of an ending thread over to the writer
+  struct RingOwner
+  {
+    Ring *ring = nullptr;
+
+    ~RingOwner()
+    {
+      if (ring != nullptr)
+      {
+        ring->orphaned.store(true, std::memory_order_release);
+      }
+    }
+  };
+
+  thread_local RingOwner ring_owner;
+
+  // std::stringbuf only hands out copies of its text (before C++20), this one
+  // appends to a string that keeps its capacity between records
+  class LineBuffer : public std::streambuf
+  {
+  public:
+    std::string text;
+
+  protected:
+    int_type overflow(int_type c) override
+    {
+      if (!traits_type::eq_int_type(c, traits_type::eof()))
+      {
+        text.push_back(traits_type::to_char_type(c));
+      }
+      return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *data, std::streamsize length) override
+    {
+      text.append(data, length);
+      return length;
+    }
+  };
+
+  struct LineStream
+  {
+    LineBuffer buffer;
+    std::ostream stream{&buffer};
+  };
+
+  thread_local LineStream line_stream;
+}
+
+static Ring *own_ring()
+{
+  if (ring_owner.ring == nullptr)
+  {
+    Ring *ring = new Ring;
+    std::lock_guard<std::mutex> lock(logger().mutex);
+    logger().rings.push_back(ring);
+    ring_owner.ring = ring;
+  }
+  return ring_owner.ring;
+}
+
+static void append_line(std::string &batch, int64_t time, LogLevel level, std::string_view text, pid_t pid)
+{
+  time_t seconds = time / 1000000000;
+  struct tm local;
+  localtime_r(&seconds, &local);
+
+  char prefix[64];
+  size_t length = strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &local);
+  snprintf(prefix + length, sizeof(prefix) - length, ".%03d %-7s [%d] ", static_cast<int>(time / 1000000 % 1000),
+           LEVEL_NAMES[static_cast<int>(level)], static_cast<int>(pid));
+  batch.append(prefix).append(text).append("\n");
+}
+
+// Moves every buffered record into batch and frees the rings of ended threads
+static void drain(std::string &batch)
+{
+  Logger &log = logger();
+  pid_t pid = getpid();
+  std::lock_guard<std::mutex> lock(log.mutex);
+  for (auto it = log.rings.begin(); it != log.rings.end();)
+  {
+    Ring *ring = *it;
+    // checked first: everything the thread wrote before it ended is drained below
+    bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    for (; head != tail; head++)
+    {
+      const Record &record = ring->records[head % GenericConstants::LOG_RING_RECORDS];
+      append_line(batch, record.time, record.level, std::string_view(record.text, record.length), pid);
+    }
+    ring->head.store(head, std::memory_order_release);
+
+    uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+      int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+      append_line(batch, now, LogLevel::Warning, std::to_string(dropped) + " log records dropped, the writer fell behind", pid);
+    }
+
+    if (orphaned)
+    {
+      delete ring;
+      it = log.rings.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+static void write_batch(const std::string &batch)
+{
+  size_t written = 0;
+  while (written < batch.size())
+  {
+    ssize_t result = ::write(logger().fd, batch.data() + written, batch.size() - written);
+    if (result < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (result <= 0)
+    {
+      return; // nowhere left to report it
+    }
+    written += result;
+  }
+}
+
+static void run_writer()
+{
+  Logger &log = logger();
+  std::string batch;
+  std::mutex wake_mutex;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(wake_mutex);
+      log.wake.wait_for(lock, std::chrono::milliseconds(GenericConstants::LOG_FLUSH_INTERVAL));
+    }
+    batch.clear();
+    drain(batch);
+    write_batch(batch);
+
+    std::lock_guard<std::mutex> lock(log.mutex);
+    if (log.stopping)
+    {
+      return;
+    }
+  }
+}
+
+// atexit: ends the writer of this process and writes what it left behind
+static void stop_writer()
+{
+  Logger &log = logger();
+  {
+    std::lock_guard<std::mutex> lock(log.mutex);
+    log.stopping = true;
+  }
+  log.wake.notify_all();
+  log.writer->join();
+
+  std::string batch;
+  drain(batch);
+  write_batch(batch);
+  log.started.store(false, std::memory_order_release); // the rest goes straight out
+}
+
+// fork(): the mutex is held across it so the child never sees a half-updated
+// ring list. The child starts with empty rings and a writer of its own, the
+// records buffered so far are the parent's to write.
+static void before_fork()
+{
+  logger().mutex.lock();
+}
+
+static void after_fork_parent()
+{
+  logger().mutex.unlock();
+}
+
+static void after_fork_child()
+{
+  Logger &log = logger();
+  for (Ring *ring : log.rings)
+  {
+    if (ring != ring_owner.ring)
+    {
+      delete ring; // its thread only exists in the parent
+    }
+  }
+  log.rings.clear();
+  if (ring_owner.ring != nullptr)
+  {
+    ring_owner.ring->head.store(ring_owner.ring->tail.load());
+    ring_owner.ring->dropped.store(0);
+    log.rings.push_back(ring_owner.ring);
+  }
+  log.mutex.unlock();
+
+  if (log.started.load(std::memory_order_relaxed))
+  {
+    log.writer = new std::thread(run_writer);
+  }
+}
+
+void Log::start(LogLevel level, const std::string &path)
+{
+  Logger &log = logger();
+  threshold = level;
+  if (!path.empty())
+  {
+    log.fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (log.fd == -1)
+    {
+      throw std::runtime_error("Unable to open log file " + path + ": " + std::strerror(errno));
+    }
+  }
+
+  // what went to stdout so far must not end up behind the first batch
+  std::cout.flush();
+  log.writer = new std::thread(run_writer);
+  log.started.store(true, std::memory_order_release);
+  pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+  atexit(stop_writer);
+}
+
+bool Log::parse_level(const std::string &name, LogLevel &level)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    std::string lower = LEVEL_NAMES[i];
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (name == lower)
+    {
+      level = static_cast<LogLevel>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+std::ostream &Log::line()
+{
+  line_stream.buffer.text.clear();
+  line_stream.stream.clear();
+  return line_stream.stream;
+}
+
+std::string_view Log::formatted()
+{
+  return line_stream.buffer.text;
+}
+
+void Log::write(LogLevel level, std::string_view text)
+{
+  if (!logger().started.load(std::memory_order_acquire))
+  {
+    std::cout << text << std::endl;
+    return;
+  }
+
+  // no lock and no syscall: the clock is read through the vDSO
+  Ring *ring = own_ring();
+  uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+  if (tail - ring->head.load(std::memory_order_acquire) >= GenericConstants::LOG_RING_RECORDS)
+  {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  Record &record = ring->records[tail % GenericConstants::LOG_RING_RECORDS];
+  record.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  record.level = level;
+  record.length = std::min(text.size(), sizeof(record.text));
+  std::memcpy(record.text, text.data(), record.length);
+  ring->tail.store(tail + 1, std::memory_order_release);
+}
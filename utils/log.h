@@ -0,0 +1,70 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <ostream>
+#include <string>
+#include <string_view>
+
+enum class LogLevel { Debug, Info, Warning, Error };
+
+// Leveled logging without syscalls on the request path.
+//
+// Every thread writes its records into a ring buffer of its own (single
+// producer, single consumer, no locks); a background thread drains all rings
+// every LOG_FLUSH_INTERVAL ms and writes them to the log with one write() per
+// batch. A full ring drops records instead of blocking, the writer reports how
+// many. Forked children get a fresh writer of their own, their batches are
+// appended to the same file.
+//
+// Until start() is called records go straight to stdout, so tools sharing code
+// with the server need no setup.
+namespace Log
+{
+    // Starts the writer, path empty: stdout. What is buffered at exit() is
+    // still written, records of a killed process are lost.
+    void start(LogLevel level, const std::string &path);
+
+    bool parse_level(const std::string &name, LogLevel &level);
+
+    inline LogLevel threshold = LogLevel::Info;
+
+    inline bool enabled(LogLevel level)
+    {
+        return level >= threshold;
+    }
+
+    void write(LogLevel level, std::string_view text);
+
+    // Stream for formatting one record, reused per thread. Its buffer keeps
+    // its capacity, so a record only allocates while the buffer still grows.
+    std::ostream &line();
+
+    // What was formatted into line() since it was last handed out
+    std::string_view formatted();
+}
+
+// The message is only formatted if the level is enabled:
+//   LOG_INFO("Saved mail " << subject << " in inbox of " << receiver);
+#define LOG_AT(level, message)                                  \
+    do                                                          \
+    {                                                           \
+        if (Log::enabled(level))                                \
+        {                                                       \
+            std::ostream &log_line_ = Log::line();              \
+            log_line_ << message;                               \
+            Log::write(level, Log::formatted());                \
+        }                                                       \
+    } while (0)
+
+// Builds with -DTWMAILER_NO_DEBUG_LOG drop debug records at compile time,
+// arguments included
+#ifdef TWMAILER_NO_DEBUG_LOG
+#define LOG_DEBUG(message) do {} while (0)
+#else
+#define LOG_DEBUG(message) LOG_AT(LogLevel::Debug, message)
+#endif
+#define LOG_INFO(message) LOG_AT(LogLevel::Info, message)
+#define LOG_WARNING(message) LOG_AT(LogLevel::Warning, message)
+#define LOG_ERROR(message) LOG_AT(LogLevel::Error, message)
+
+#endif // LOG_H
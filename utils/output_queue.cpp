@@ -0,0 +1,186 @@
+#include "output_queue.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "log.h"
+
+// a queue that never runs empty moves its unsent chunks to the front instead
+static constexpr size_t COMPACT_MIN_SENT_CHUNKS = 64;
+
+OutputQueue::~OutputQueue()
+{
+  while (has_chunks())
+  {
+    pop_front();
+  }
+}
+
+void OutputQueue::append(const char *data, size_t length)
+{
+  if (!has_chunks() || chunks.back().fd != -1 || chunks.back().sealed)
+  {
+    chunks.emplace_back();
+    chunks.back().data.swap(spare);
+  }
+  chunks.back().data.append(data, length);
+  chunks.back().length += length;
+  pending += length;
+}
+
+void OutputQueue::append(std::string &&data)
+{
+  chunks.emplace_back();
+  Chunk &chunk = chunks.back();
+  chunk.length = data.size();
+  chunk.data = std::move(data);
+  chunk.sealed = true;
+  pending += chunk.length;
+}
+
+void OutputQueue::append_file(int fd, off_t offset, size_t length)
+{
+  chunks.emplace_back();
+  Chunk &chunk = chunks.back();
+  chunk.fd = fd;
+  chunk.offset = offset;
+  chunk.length = length;
+  pending += length;
+  file_chunks++;
+}
+
+void OutputQueue::pop_front()
+{
+  Chunk &chunk = chunks[head];
+  pending -= chunk.length - chunk.sent;
+  if (chunk.fd != -1)
+  {
+    close(chunk.fd);
+    file_chunks--;
+  }
+  else if (!chunk.sealed)
+  {
+    chunk.data.clear();
+    spare.swap(chunk.data);
+  }
+  else
+  {
+    // moved in bodies can be large, free them right away
+    chunk.data.clear();
+    chunk.data.shrink_to_fit();
+  }
+
+  head++;
+  if (head == chunks.size())
+  {
+    chunks.clear();
+    head = 0;
+  }
+  else if (head >= COMPACT_MIN_SENT_CHUNKS && head * 2 >= chunks.size())
+  {
+    chunks.erase(chunks.begin(), chunks.begin() + head);
+    head = 0;
+  }
+}
+
+// Marks sent bytes of the leading chunks as done
+void OutputQueue::consume(size_t sent)
+{
+  while (sent > 0)
+  {
+    Chunk &chunk = chunks[head];
+    size_t part = std::min(sent, chunk.length - chunk.sent);
+    chunk.sent += part;
+    pending -= part;
+    sent -= part;
+    if (chunk.sent == chunk.length)
+    {
+      pop_front();
+    }
+  }
+}
+
+size_t OutputQueue::gather(struct iovec *iov, size_t max) const
+{
+  size_t count = 0;
+  for (auto chunk = chunks.begin() + head; chunk != chunks.end() && chunk->fd == -1 && count < max; ++chunk)
+  {
+    iov[count].iov_base = const_cast<char *>(chunk->data.data()) + chunk->sent;
+    iov[count].iov_len = chunk->length - chunk->sent;
+    count++;
+  }
+  return count;
+}
+
+// One sendmsg() over the memory chunks in front of the next file chunk
+ssize_t OutputQueue::send_memory_chunks(int socket_fd)
+{
+  struct iovec iov[MAX_GATHER];
+  size_t count = gather(iov, MAX_GATHER);
+
+  struct msghdr message;
+  std::memset(&message, 0, sizeof(message));
+  message.msg_iov = iov;
+  message.msg_iovlen = count;
+
+  // more is queued behind this call: let the kernel wait for it before pushing a segment
+  int flags = MSG_NOSIGNAL | (count < chunks.size() - head ? MSG_MORE : 0);
+  return sendmsg(socket_fd, &message, flags);
+}
+
+ssize_t OutputQueue::send_file_chunk(int socket_fd)
+{
+  Chunk &chunk = chunks[head];
+  ssize_t result = sendfile(socket_fd, chunk.fd, &chunk.offset, chunk.length - chunk.sent);
+  if (result == 0)
+  {
+    LOG_ERROR("Stored message ended before its recorded length");
+    errno = EIO;
+    return -1;
+  }
+  return result;
+}
+
+bool OutputQueue::flush(int socket_fd)
+{
+  // while corked the reply header, the file and the bytes behind it leave in
+  // full segments instead of a small packet on every boundary
+  bool corked = false;
+  if (file_chunks > 0)
+  {
+    int enable = 1;
+    corked = setsockopt(socket_fd, IPPROTO_TCP, TCP_CORK, &enable, sizeof(enable)) == 0;
+  }
+
+  bool ok = true;
+  while (has_chunks())
+  {
+    ssize_t result = chunks[head].fd == -1 ? send_memory_chunks(socket_fd) : send_file_chunk(socket_fd);
+    if (result > 0)
+    {
+      consume(result); // partial writes resume in the middle of a chunk
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+      break; // non-blocking socket is full, the rest goes out on the next EPOLLOUT
+    }
+    else if (errno != EINTR)
+    {
+      LOG_ERROR("Sending response failed: " << std::strerror(errno));
+      ok = false;
+      break;
+    }
+  }
+
+  if (corked)
+  {
+    int disable = 0;
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_CORK, &disable, sizeof(disable));
+  }
+  return ok;
+}
@@ -0,0 +1,79 @@
+#ifndef OUTPUT_QUEUE_H
+#define OUTPUT_QUEUE_H
+
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+// Bytes waiting to be written to a client socket, in reply order.
+//
+// Small pieces are copied into a shared buffer, large bodies are moved in as
+// chunks of their own and stored messages can be queued as a file region.
+// flush() sends consecutive memory chunks with one scatter-gather sendmsg()
+// and file regions with sendfile(), so neither the replies of a pipelined
+// batch nor header and body of one reply are ever joined into one string.
+// Replies are queued through ResponseWriter.
+class OutputQueue
+{
+public:
+    OutputQueue() = default;
+    ~OutputQueue();
+
+    OutputQueue(const OutputQueue &) = delete;
+    OutputQueue &operator=(const OutputQueue &) = delete;
+
+    // Copies data behind the pending bytes
+    void append(const char *data, size_t length);
+
+    // Takes over data as a chunk of its own, without copying it
+    void append(std::string &&data);
+
+    // Queues length bytes of fd starting at offset, the queue owns and closes fd
+    void append_file(int fd, off_t offset, size_t length);
+
+    // Sends as much as the socket takes; what is left stays queued (EAGAIN on
+    // a non-blocking socket). Returns false on a socket or file error.
+    bool flush(int socket_fd);
+
+    // For callers that write to the socket themselves, e.g. through io_uring:
+    // describes the memory chunks in front of the first file chunk (0 if a file
+    // comes first) and marks what was written as sent afterwards. Nothing may
+    // be appended in between, the iovecs point into the queue.
+    static constexpr size_t MAX_GATHER = 64;
+    size_t gather(struct iovec *iov, size_t max) const;
+    void consume(size_t sent);
+
+    // File regions are sent with sendfile() by flush() only
+    bool file_in_front() const { return has_chunks() && chunks[head].fd != -1; }
+
+    size_t size() const { return pending; }
+    bool empty() const { return pending == 0; }
+
+private:
+    struct Chunk
+    {
+        std::string data;    // used if fd == -1
+        bool sealed = false; // moved in, later appends start a new chunk
+        int fd = -1;
+        off_t offset = 0;    // next file byte to send
+        size_t length = 0;
+        size_t sent = 0;
+    };
+
+    // sent chunks in front of head are dropped in bulk once the queue runs
+    // empty, so a connection in steady state reuses the same storage
+    std::vector<Chunk> chunks;
+    size_t head = 0; // first unsent chunk
+    size_t pending = 0;
+    size_t file_chunks = 0;
+    std::string spare; // buffer of the last drained chunk, reused to avoid reallocating
+
+    bool has_chunks() const { return head < chunks.size(); }
+    void pop_front();
+    ssize_t send_memory_chunks(int socket_fd);
+    ssize_t send_file_chunk(int socket_fd);
+};
+
+#endif // OUTPUT_QUEUE_H
@@ -0,0 +1,43 @@
+#include "request_arena.h"
+#include <algorithm>
+#include <cstdint>
+#include "constants.h"
+
+void RequestArena::reset()
+{
+  // a single huge request must not pin its memory for the rest of the connection
+  if (retained > ServerConstants::REQUEST_ARENA_MAX_RETAINED)
+  {
+    blocks.clear();
+    retained = 0;
+  }
+  current = 0;
+  used = 0;
+}
+
+void *RequestArena::do_allocate(size_t bytes, size_t alignment)
+{
+  while (current < blocks.size())
+  {
+    Block &block = blocks[current];
+    uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+    size_t offset = ((base + used + alignment - 1) & ~(alignment - 1)) - base;
+    if (offset + bytes <= block.size)
+    {
+      used = offset + bytes;
+      return block.data.get() + offset;
+    }
+    // the rest of this block stays unused until the next reset
+    current++;
+    used = 0;
+  }
+
+  // new[] aligns for every fundamental type, larger alignments get the slack
+  size_t needed = bytes + (alignment > alignof(std::max_align_t) ? alignment : 0);
+  size_t size = std::max(blocks.empty() ? ServerConstants::REQUEST_ARENA_BLOCK_SIZE : blocks.back().size * 2, needed);
+  blocks.push_back(Block{std::unique_ptr<char[]>(new char[size]), size});
+  retained += size;
+  current = blocks.size() - 1;
+  used = 0;
+  return do_allocate(bytes, alignment);
+}
@@ -0,0 +1,51 @@
+#ifndef REQUEST_ARENA_H
+#define REQUEST_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// Bump allocator for the temporaries of one request: parsed fields, the
+// messages of a LIST, the content of a READ. Handlers take them through
+// std::pmr containers; nothing is freed on its own, reset() rewinds the whole
+// arena once the request is answered.
+//
+// Unlike std::pmr::monotonic_buffer_resource the blocks are kept across
+// resets, so once a connection has seen its largest request the following ones
+// do not touch the heap at all. Arenas that grew beyond
+// REQUEST_ARENA_MAX_RETAINED give their blocks back instead.
+//
+// Not thread-safe, each connection has its own.
+class RequestArena : public std::pmr::memory_resource
+{
+public:
+    RequestArena() = default;
+
+    RequestArena(const RequestArena &) = delete;
+    RequestArena &operator=(const RequestArena &) = delete;
+
+    // Everything allocated so far becomes invalid
+    void reset();
+
+    // Bytes held in blocks, used or not
+    size_t capacity() const { return retained; }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current = 0; // block allocations are taken from
+    size_t used = 0;    // bytes taken from the current block
+    size_t retained = 0;
+
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+#endif // REQUEST_ARENA_H
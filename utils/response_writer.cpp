@@ -0,0 +1,47 @@
+#include "response_writer.h"
+#include <charconv>
+#include <cstring>
+
+static constexpr std::string_view HEADER_PREFIX = "Content-Length: ";
+
+// below this a fragment is cheaper to copy than to queue as a chunk of its own
+static constexpr size_t MIN_MOVED_FRAGMENT = 4096;
+
+ResponseWriter::ResponseWriter(OutputQueue &out, size_t content_length)
+: out(out)
+, content_length(content_length)
+{
+  char header[HEADER_PREFIX.size() + 21];
+  std::memcpy(header, HEADER_PREFIX.data(), HEADER_PREFIX.size());
+  char *end = std::to_chars(header + HEADER_PREFIX.size(), header + sizeof(header) - 1, content_length).ptr;
+  *end++ = '\n';
+  out.append(header, end - header);
+}
+
+ResponseWriter &ResponseWriter::write(std::string_view fragment)
+{
+  out.append(fragment.data(), fragment.size());
+  written += fragment.size();
+  return *this;
+}
+
+ResponseWriter &ResponseWriter::write_owned(std::string &&fragment)
+{
+  written += fragment.size();
+  if (fragment.size() < MIN_MOVED_FRAGMENT)
+  {
+    out.append(fragment.data(), fragment.size());
+  }
+  else
+  {
+    out.append(std::move(fragment));
+  }
+  return *this;
+}
+
+ResponseWriter &ResponseWriter::write_file(int fd, off_t offset, size_t length)
+{
+  out.append_file(fd, offset, length);
+  written += length;
+  return *this;
+}
@@ -0,0 +1,37 @@
+#ifndef RESPONSE_WRITER_H
+#define RESPONSE_WRITER_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include "output_queue.h"
+
+// Queues one framed reply ("Content-Length: <n>\n" + body) without building it
+// in a string first. The header is formatted in a stack buffer, the body is
+// passed as any number of fragments, which together must be exactly
+// content_length bytes:
+//
+//   ResponseWriter reply(out, ok.size() + content.size() + 1);
+//   reply.write(ok).write_owned(std::move(content)).write("\n");
+class ResponseWriter
+{
+public:
+    ResponseWriter(OutputQueue &out, size_t content_length);
+
+    // small fragments are copied into the queue's buffer
+    ResponseWriter &write(std::string_view fragment);
+    // large ones are moved into the queue and sent from where they are
+    ResponseWriter &write_owned(std::string &&fragment);
+    // region of a stored message, sent with sendfile(); the queue closes fd
+    ResponseWriter &write_file(int fd, off_t offset, size_t length);
+
+    bool complete() const { return written == content_length; }
+
+private:
+    OutputQueue &out;
+    size_t content_length;
+    size_t written = 0;
+};
+
+#endif // RESPONSE_WRITER_H